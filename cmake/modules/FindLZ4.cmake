@@ -0,0 +1,32 @@
+#
+#    This program is free software: you can redistribute it and/or modify
+#    it under the terms of the GNU General Public License as published by
+#    the Free Software Foundation, either version 3 of the License, or
+#    (at your option) any later version.
+#
+#    This program is distributed in the hope that it will be useful,
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#    GNU General Public License for more details.
+#
+#    You should have received a copy of the GNU General Public License
+#    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#
+#        Authors:        David Ducos, Percona (david dot ducos at percona dot com)
+
+if(LZ4_INCLUDE_DIR AND LZ4_LIBRARIES)
+    # Already in cache, be silent
+    set(LZ4_FIND_QUIETLY TRUE)
+endif(LZ4_INCLUDE_DIR AND LZ4_LIBRARIES)
+
+if (NOT WIN32)
+   include(FindPkgConfig)
+   pkg_search_module(PC_LZ4 REQUIRED liblz4)
+endif(NOT WIN32)
+
+set(LZ4_INCLUDE_DIR ${PC_LZ4_INCLUDE_DIRS})
+
+find_library(LZ4_LIBRARIES NAMES lz4 HINTS ${PC_LZ4_LIBDIR} ${PC_LZ4_LIBRARY_DIRS})
+
+mark_as_advanced(LZ4_INCLUDE_DIR LZ4_LIBRARIES)
+
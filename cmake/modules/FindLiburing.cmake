@@ -0,0 +1,32 @@
+#
+#    This program is free software: you can redistribute it and/or modify
+#    it under the terms of the GNU General Public License as published by
+#    the Free Software Foundation, either version 3 of the License, or
+#    (at your option) any later version.
+#
+#    This program is distributed in the hope that it will be useful,
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#    GNU General Public License for more details.
+#
+#    You should have received a copy of the GNU General Public License
+#    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#
+#        Authors:        David Ducos, Percona (david dot ducos at percona dot com)
+
+if(LIBURING_INCLUDE_DIR AND LIBURING_LIBRARIES)
+    # Already in cache, be silent
+    set(LIBURING_FIND_QUIETLY TRUE)
+endif(LIBURING_INCLUDE_DIR AND LIBURING_LIBRARIES)
+
+if (NOT WIN32)
+   include(FindPkgConfig)
+   pkg_search_module(PC_LIBURING REQUIRED liburing)
+endif(NOT WIN32)
+
+set(LIBURING_INCLUDE_DIR ${PC_LIBURING_INCLUDE_DIRS})
+
+find_library(LIBURING_LIBRARIES NAMES uring HINTS ${PC_LIBURING_LIBDIR} ${PC_LIBURING_LIBRARY_DIRS})
+
+mark_as_advanced(LIBURING_INCLUDE_DIR LIBURING_LIBRARIES)
+
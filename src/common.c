@@ -99,6 +99,18 @@ GKeyFile * load_config_file(gchar * config_file){
   return kf;
 }
 
+/* Options with G_OPTION_FLAG_OPTIONAL_ARG. Their value is only bound for sure
+ * when it is given as --key=value, and an empty one means the option alone */
+static const gchar *optional_argument_options[] = {"compress", "innodb-optimize-keys", NULL};
+
+gboolean is_optional_argument_option(const gchar *key){
+  guint i;
+  for (i=0; optional_argument_options[i]; i++)
+    if (!g_strcmp0(optional_argument_options[i], key))
+      return TRUE;
+  return FALSE;
+}
+
 void load_config_group(GKeyFile *kf, GOptionContext *context, const gchar * group){
   gsize len=0;
   GError *error = NULL;
@@ -111,9 +123,15 @@ void load_config_group(GKeyFile *kf, GOptionContext *context, const gchar * grou
     // Transform the key-value pair to parameters option that the parsing will understand
     for (i=0; i < len; i++){
       if (g_strcmp0("host",keys[i]) && g_strcmp0("user",keys[i]) && g_strcmp0("password",keys[i])){
-        list = g_slist_append(list, g_strdup_printf("--%s",keys[i]));
         gchar *value=g_key_file_get_value(kf,group,keys[i],&error);
-        if ( value != NULL ) list=g_slist_append(list, value);
+        if ( value != NULL && is_optional_argument_option(keys[i])){
+          list = g_slist_append(list, *value ? g_strdup_printf("--%s=%s",keys[i],value)
+                                             : g_strdup_printf("--%s",keys[i]));
+          g_free(value);
+        }else{
+          list = g_slist_append(list, g_strdup_printf("--%s",keys[i]));
+          if ( value != NULL ) list=g_slist_append(list, value);
+        }
       }
     }
     gint slen = g_slist_length(list) + 1;
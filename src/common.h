@@ -33,6 +33,7 @@ void create_backup_dir(char *new_directory) ;
 guint strcount(gchar *text);
 gboolean m_remove(gchar * directory, const gchar * filename);
 GKeyFile * load_config_file(gchar * config_file);
+gboolean is_optional_argument_option(const gchar *key);
 void load_config_group(GKeyFile *kf, GOptionContext *context, const gchar * group);
 void execute_gstring(MYSQL *conn, GString *ss);
 gchar *replace_escaped_strings(gchar *c);
@@ -0,0 +1,645 @@
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Authors:        David Ducos, Percona (david dot ducos at percona dot com)
+*/
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <stdio.h>
+#include <string.h>
+#include <zlib.h>
+#ifdef WITH_ZSTD
+#include <zstd.h>
+#endif
+#ifdef WITH_LZ4
+#include <lz4frame.h>
+#endif
+#include "compression.h"
+
+/* Set by mydumper's --compress, --compress-level, --compress-long and
+ * --compress-workers */
+enum compression_method compression_method = COMPRESSION_NONE;
+gint compress_level = -1;
+gboolean compress_long = FALSE;
+guint compress_workers = 0;
+
+/* The zstd dictionaries myloader has read, by their id */
+GHashTable *zstd_dictionaries = NULL;
+GMutex *zstd_dictionaries_mutex = NULL;
+
+static const gchar *compression_names[] = {"none", "gzip", "zstd", "lz4"};
+static const gchar *compression_extensions[] = {"", ".gz", ".zst", ".lz4"};
+
+void initialize_compression() {
+  zstd_dictionaries = g_hash_table_new(g_direct_hash, g_direct_equal);
+  zstd_dictionaries_mutex = g_mutex_new();
+}
+
+gboolean parse_compression_method(const gchar *name,
+                                  enum compression_method *method) {
+  guint i;
+  for (i = 0; i < G_N_ELEMENTS(compression_names); i++)
+    if (!g_ascii_strcasecmp(name, compression_names[i])) {
+      *method = i;
+      return TRUE;
+    }
+  return FALSE;
+}
+
+gboolean is_compression_method_available(enum compression_method method) {
+  switch (method) {
+  case COMPRESSION_NONE:
+  case COMPRESSION_GZIP:
+    return TRUE;
+  case COMPRESSION_ZSTD:
+#ifdef WITH_ZSTD
+    return TRUE;
+#else
+    return FALSE;
+#endif
+  case COMPRESSION_LZ4:
+#ifdef WITH_LZ4
+    return TRUE;
+#else
+    return FALSE;
+#endif
+  default:
+    return FALSE;
+  }
+}
+
+const gchar *get_compression_extension(enum compression_method method) {
+  return compression_extensions[method];
+}
+
+/* Files are decompressed with the codec their suffix names, so a directory
+ * can have files of different dumps */
+enum compression_method get_compression_method_for(const gchar *filename) {
+  guint i;
+  for (i = COMPRESSION_GZIP; i < G_N_ELEMENTS(compression_extensions); i++)
+    if (g_str_has_suffix(filename, compression_extensions[i]))
+      return i;
+  return COMPRESSION_NONE;
+}
+
+gboolean is_compressed_filename(const gchar *filename) {
+  return get_compression_method_for(filename) != COMPRESSION_NONE;
+}
+
+/* gzopen takes the level in the mode */
+FILE *gzip_open(const char *filename, const char *mode) {
+  gchar *level_mode = compress_level >= 0
+                          ? g_strdup_printf("%s%d", mode, compress_level)
+                          : g_strdup(mode);
+  FILE *file = (void *)gzopen(filename, level_mode);
+  g_free(level_mode);
+  return file;
+}
+
+#ifdef WITH_ZSTD
+struct zstd_writer {
+  FILE *file;
+  ZSTD_CCtx *cctx;
+  ZSTD_outBuffer out;
+};
+
+void configure_zstd_context(void *cctx, gboolean use_workers) {
+  size_t r = ZSTD_CCtx_setParameter(
+      cctx, ZSTD_c_compressionLevel,
+      compress_level >= 0 ? compress_level : ZSTD_CLEVEL_DEFAULT);
+  if (!ZSTD_isError(r) && compress_long)
+    r = ZSTD_CCtx_setParameter(cctx, ZSTD_c_enableLongDistanceMatching, 1);
+  if (ZSTD_isError(r))
+    g_warning("Could not set the zstd parameters: %s", ZSTD_getErrorName(r));
+  /* libzstd can be built without threads */
+  if (use_workers && compress_workers &&
+      ZSTD_isError(ZSTD_CCtx_setParameter(cctx, ZSTD_c_nbWorkers,
+                                          compress_workers)))
+    g_warning("libzstd was built without multithreading, "
+              "--compress-workers ignored");
+}
+
+gboolean zstd_flush(struct zstd_writer *zw) {
+  if (zw->out.pos && fwrite(zw->out.dst, 1, zw->out.pos, zw->file) != zw->out.pos)
+    return FALSE;
+  zw->out.pos = 0;
+  return TRUE;
+}
+
+/* The dictionary is shared by every file of the table that uses it */
+void *new_zstd_dictionary(const gchar *data, gsize len) {
+  return ZSTD_createCDict(data, len, compress_level >= 0 ? compress_level
+                                                         : ZSTD_CLEVEL_DEFAULT);
+}
+
+FILE *zstd_open_with_dictionary(const char *filename, const char *mode,
+                                void *dictionary) {
+  struct zstd_writer *zw;
+  FILE *file = g_fopen(filename, mode);
+  if (!file)
+    return NULL;
+  zw = g_new0(struct zstd_writer, 1);
+  zw->file = file;
+  zw->cctx = ZSTD_createCCtx();
+  configure_zstd_context(zw->cctx, TRUE);
+  if (dictionary)
+    ZSTD_CCtx_refCDict(zw->cctx, dictionary);
+  zw->out.size = ZSTD_CStreamOutSize();
+  zw->out.dst = g_malloc(zw->out.size);
+  return (FILE *)zw;
+}
+
+FILE *zstd_open(const char *filename, const char *mode) {
+  return zstd_open_with_dictionary(filename, mode, NULL);
+}
+
+int zstd_write(FILE *file, const char *buff, int len) {
+  struct zstd_writer *zw = (struct zstd_writer *)file;
+  ZSTD_inBuffer in = {buff, len, 0};
+  size_t r;
+  while (in.pos < in.size) {
+    r = ZSTD_compressStream2(zw->cctx, &zw->out, &in, ZSTD_e_continue);
+    if (ZSTD_isError(r)) {
+      g_critical("Could not compress data: %s", ZSTD_getErrorName(r));
+      return -1;
+    }
+    if (zw->out.pos == zw->out.size && !zstd_flush(zw))
+      return -1;
+  }
+  return len;
+}
+
+int zstd_close(void *file) {
+  struct zstd_writer *zw = file;
+  ZSTD_inBuffer in = {NULL, 0, 0};
+  size_t remaining;
+  int r = 0;
+  do {
+    remaining = ZSTD_compressStream2(zw->cctx, &zw->out, &in, ZSTD_e_end);
+    if (ZSTD_isError(remaining) || !zstd_flush(zw)) {
+      r = EOF;
+      break;
+    }
+  } while (remaining);
+  if (fclose(zw->file))
+    r = EOF;
+  ZSTD_freeCCtx(zw->cctx);
+  g_free(zw->out.dst);
+  g_free(zw);
+  return r;
+}
+#else
+void configure_zstd_context(void *cctx, gboolean use_workers) {
+  (void)cctx;
+  (void)use_workers;
+}
+
+void *new_zstd_dictionary(const gchar *data, gsize len) {
+  (void)data;
+  (void)len;
+  return NULL;
+}
+
+FILE *zstd_open_with_dictionary(const char *filename, const char *mode,
+                                void *dictionary) {
+  (void)filename;
+  (void)mode;
+  (void)dictionary;
+  return NULL;
+}
+
+FILE *zstd_open(const char *filename, const char *mode) {
+  (void)filename;
+  (void)mode;
+  return NULL;
+}
+
+int zstd_write(FILE *file, const char *buff, int len) {
+  (void)file;
+  (void)buff;
+  (void)len;
+  return -1;
+}
+
+int zstd_close(void *file) {
+  (void)file;
+  return EOF;
+}
+#endif
+
+#ifdef WITH_LZ4
+/* lz4 compresses its input in pieces that fit the output buffer */
+#define LZ4_INPUT_SIZE (64 * 1024)
+
+struct lz4_writer {
+  FILE *file;
+  LZ4F_cctx *cctx;
+  gchar *out;
+  gsize out_size;
+};
+
+/* The fast mode unless a level is given, the reason to use lz4 */
+void get_lz4_preferences(LZ4F_preferences_t *preferences) {
+  memset(preferences, 0, sizeof(*preferences));
+  preferences->compressionLevel = compress_level >= 0 ? compress_level : 0;
+  preferences->frameInfo.contentChecksumFlag = LZ4F_contentChecksumEnabled;
+}
+
+FILE *lz4_open(const char *filename, const char *mode) {
+  struct lz4_writer *lw;
+  LZ4F_preferences_t preferences;
+  size_t r;
+  FILE *file = g_fopen(filename, mode);
+  if (!file)
+    return NULL;
+  get_lz4_preferences(&preferences);
+  lw = g_new0(struct lz4_writer, 1);
+  lw->file = file;
+  lw->out_size = LZ4F_compressBound(LZ4_INPUT_SIZE, &preferences);
+  lw->out = g_malloc(MAX(lw->out_size, LZ4F_HEADER_SIZE_MAX));
+  r = LZ4F_createCompressionContext(&lw->cctx, LZ4F_VERSION);
+  if (!LZ4F_isError(r))
+    r = LZ4F_compressBegin(lw->cctx, lw->out, lw->out_size, &preferences);
+  if (LZ4F_isError(r) || fwrite(lw->out, 1, r, file) != r) {
+    g_critical("Could not start lz4 file %s: %s", filename,
+               LZ4F_isError(r) ? LZ4F_getErrorName(r) : "write error");
+    LZ4F_freeCompressionContext(lw->cctx);
+    fclose(file);
+    g_free(lw->out);
+    g_free(lw);
+    return NULL;
+  }
+  return (FILE *)lw;
+}
+
+int lz4_write(FILE *file, const char *buff, int len) {
+  struct lz4_writer *lw = (struct lz4_writer *)file;
+  gsize done = 0, piece;
+  size_t r;
+  while (done < (gsize)len) {
+    piece = MIN(LZ4_INPUT_SIZE, len - done);
+    r = LZ4F_compressUpdate(lw->cctx, lw->out, lw->out_size, buff + done,
+                            piece, NULL);
+    if (LZ4F_isError(r)) {
+      g_critical("Could not compress data: %s", LZ4F_getErrorName(r));
+      return -1;
+    }
+    if (r && fwrite(lw->out, 1, r, lw->file) != r)
+      return -1;
+    done += piece;
+  }
+  return len;
+}
+
+int lz4_close(void *file) {
+  struct lz4_writer *lw = file;
+  int ret = 0;
+  size_t r = LZ4F_compressEnd(lw->cctx, lw->out, lw->out_size, NULL);
+  if (LZ4F_isError(r) || fwrite(lw->out, 1, r, lw->file) != r)
+    ret = EOF;
+  if (fclose(lw->file))
+    ret = EOF;
+  LZ4F_freeCompressionContext(lw->cctx);
+  g_free(lw->out);
+  g_free(lw);
+  return ret;
+}
+
+/* For the writer threads, which compress a whole block into one frame */
+void *new_lz4_context() {
+  LZ4F_cctx *cctx = NULL;
+  if (LZ4F_isError(LZ4F_createCompressionContext(&cctx, LZ4F_VERSION)))
+    return NULL;
+  return cctx;
+}
+
+void free_lz4_context(void *cctx) {
+  LZ4F_freeCompressionContext(cctx);
+}
+
+gsize lz4_frame_bound(gsize len) {
+  LZ4F_preferences_t preferences;
+  get_lz4_preferences(&preferences);
+  return LZ4F_HEADER_SIZE_MAX + LZ4F_compressBound(len, &preferences);
+}
+
+/* Compresses the pieces into one frame at out, which has lz4_frame_bound of
+ * their length, and returns its size or 0 on error */
+gsize lz4_compress_frame(void *cctx, gchar *out, gsize out_size,
+                         const gchar *first, gsize first_len,
+                         const gchar *second, gsize second_len) {
+  LZ4F_preferences_t preferences;
+  gsize pos;
+  size_t r;
+  get_lz4_preferences(&preferences);
+  r = LZ4F_compressBegin(cctx, out, out_size, &preferences);
+  if (LZ4F_isError(r))
+    goto error;
+  pos = r;
+  if (first_len) {
+    r = LZ4F_compressUpdate(cctx, out + pos, out_size - pos, first, first_len,
+                            NULL);
+    if (LZ4F_isError(r))
+      goto error;
+    pos += r;
+  }
+  if (second_len) {
+    r = LZ4F_compressUpdate(cctx, out + pos, out_size - pos, second,
+                            second_len, NULL);
+    if (LZ4F_isError(r))
+      goto error;
+    pos += r;
+  }
+  r = LZ4F_compressEnd(cctx, out + pos, out_size - pos, NULL);
+  if (LZ4F_isError(r))
+    goto error;
+  return pos + r;
+error:
+  g_critical("Could not compress data: %s", LZ4F_getErrorName(r));
+  return 0;
+}
+#else
+FILE *lz4_open(const char *filename, const char *mode) {
+  (void)filename;
+  (void)mode;
+  return NULL;
+}
+
+int lz4_write(FILE *file, const char *buff, int len) {
+  (void)file;
+  (void)buff;
+  (void)len;
+  return -1;
+}
+
+int lz4_close(void *file) {
+  (void)file;
+  return EOF;
+}
+#endif
+
+/* Reads a dictionary written by mydumper. The files compressed with it name
+ * it by its id, which is how the reader finds it. */
+gboolean register_zstd_dictionary(const gchar *filename) {
+#ifdef WITH_ZSTD
+  gchar *data = NULL;
+  gsize len = 0;
+  GError *error = NULL;
+  ZSTD_DDict *ddict;
+  guint id;
+  if (!g_file_get_contents(filename, &data, &len, &error)) {
+    g_critical("Could not read dictionary %s: %s", filename, error->message);
+    g_error_free(error);
+    return FALSE;
+  }
+  ddict = ZSTD_createDDict(data, len);
+  g_free(data);
+  id = ddict ? ZSTD_getDictID_fromDDict(ddict) : 0;
+  if (!id) {
+    g_critical("%s is not a zstd dictionary", filename);
+    if (ddict)
+      ZSTD_freeDDict(ddict);
+    return FALSE;
+  }
+  g_mutex_lock(zstd_dictionaries_mutex);
+  if (g_hash_table_lookup(zstd_dictionaries, GUINT_TO_POINTER(id)))
+    ZSTD_freeDDict(ddict);
+  else
+    g_hash_table_insert(zstd_dictionaries, GUINT_TO_POINTER(id), ddict);
+  g_mutex_unlock(zstd_dictionaries_mutex);
+  return TRUE;
+#else
+  g_critical("zstd support is not built in, cannot read %s", filename);
+  return FALSE;
+#endif
+}
+
+/* A compressed file being read, with a line interface like gzgets */
+struct compressed_file {
+  enum compression_method method;
+  gzFile gz;
+  FILE *file;
+#ifdef WITH_ZSTD
+  ZSTD_DCtx *dctx;
+  ZSTD_inBuffer in;
+#endif
+#ifdef WITH_LZ4
+  LZ4F_dctx *lz4;
+#endif
+  gsize in_pos;
+  gsize in_len;
+  gchar *in_buffer;
+  gsize in_size;
+  gchar *out_buffer;
+  gsize out_size;
+  gsize out_pos;
+  gsize out_len;
+  gboolean eof;
+  gboolean started;
+};
+
+void *open_compressed_file(const gchar *filename) {
+  struct compressed_file *cf = g_new0(struct compressed_file, 1);
+  cf->method = get_compression_method_for(filename);
+  switch (cf->method) {
+  case COMPRESSION_GZIP:
+    cf->gz = gzopen(filename, "r");
+    if (cf->gz)
+      return cf;
+    break;
+#ifdef WITH_ZSTD
+  case COMPRESSION_ZSTD:
+    cf->file = g_fopen(filename, "r");
+    if (!cf->file)
+      break;
+    cf->dctx = ZSTD_createDCtx();
+    cf->in_size = ZSTD_DStreamInSize();
+    cf->in_buffer = g_malloc(cf->in_size);
+    cf->in.src = cf->in_buffer;
+    cf->out_size = ZSTD_DStreamOutSize();
+    cf->out_buffer = g_malloc(cf->out_size);
+    return cf;
+#endif
+#ifdef WITH_LZ4
+  case COMPRESSION_LZ4:
+    cf->file = g_fopen(filename, "r");
+    if (!cf->file)
+      break;
+    if (LZ4F_isError(LZ4F_createDecompressionContext(&cf->lz4, LZ4F_VERSION))) {
+      fclose(cf->file);
+      break;
+    }
+    cf->in_size = LZ4_INPUT_SIZE;
+    cf->in_buffer = g_malloc(cf->in_size);
+    cf->out_size = 4 * LZ4_INPUT_SIZE;
+    cf->out_buffer = g_malloc(cf->out_size);
+    return cf;
+#endif
+  default:
+    g_critical("%s support is not built in, cannot read %s",
+               compression_names[cf->method], filename);
+    break;
+  }
+  g_free(cf);
+  return NULL;
+}
+
+#ifdef WITH_ZSTD
+/* Every frame of a file is compressed with the same dictionary, if any */
+gboolean zstd_use_dictionary(struct compressed_file *cf) {
+  guint id = ZSTD_getDictID_fromFrame(cf->in_buffer, cf->in.size);
+  ZSTD_DDict *ddict;
+  if (!id)
+    return TRUE;
+  g_mutex_lock(zstd_dictionaries_mutex);
+  ddict = g_hash_table_lookup(zstd_dictionaries, GUINT_TO_POINTER(id));
+  g_mutex_unlock(zstd_dictionaries_mutex);
+  if (!ddict) {
+    g_critical("The zstd dictionary %u was not found", id);
+    return FALSE;
+  }
+  ZSTD_DCtx_refDDict(cf->dctx, ddict);
+  return TRUE;
+}
+
+/* Decompresses the next piece of the file. Frames written one after the
+ * other, like the blocks of --write-threads, are read as one stream. */
+gboolean zstd_fill(struct compressed_file *cf) {
+  ZSTD_outBuffer out = {cf->out_buffer, cf->out_size, 0};
+  size_t r;
+  while (!out.pos) {
+    if (cf->in.pos == cf->in.size) {
+      cf->in.size = fread(cf->in_buffer, 1, cf->in_size, cf->file);
+      cf->in.pos = 0;
+      if (!cf->in.size) {
+        cf->eof = TRUE;
+        return FALSE;
+      }
+      if (!cf->started && !zstd_use_dictionary(cf)) {
+        cf->eof = TRUE;
+        return FALSE;
+      }
+      cf->started = TRUE;
+    }
+    r = ZSTD_decompressStream(cf->dctx, &out, &cf->in);
+    if (ZSTD_isError(r)) {
+      g_critical("Could not decompress data: %s", ZSTD_getErrorName(r));
+      cf->eof = TRUE;
+      return FALSE;
+    }
+  }
+  cf->out_pos = 0;
+  cf->out_len = out.pos;
+  return TRUE;
+}
+#endif
+
+#ifdef WITH_LZ4
+/* Frames written one after the other are read as one stream too, as the
+ * context starts a new frame once it finishes one */
+gboolean lz4_fill(struct compressed_file *cf) {
+  size_t out_len, in_len, r;
+  cf->out_len = 0;
+  while (!cf->out_len) {
+    if (cf->in_pos == cf->in_len) {
+      cf->in_len = fread(cf->in_buffer, 1, cf->in_size, cf->file);
+      cf->in_pos = 0;
+      if (!cf->in_len) {
+        cf->eof = TRUE;
+        return FALSE;
+      }
+    }
+    out_len = cf->out_size;
+    in_len = cf->in_len - cf->in_pos;
+    r = LZ4F_decompress(cf->lz4, cf->out_buffer, &out_len,
+                        cf->in_buffer + cf->in_pos, &in_len, NULL);
+    if (LZ4F_isError(r)) {
+      g_critical("Could not decompress data: %s", LZ4F_getErrorName(r));
+      cf->eof = TRUE;
+      return FALSE;
+    }
+    cf->in_pos += in_len;
+    cf->out_len = out_len;
+  }
+  cf->out_pos = 0;
+  return TRUE;
+}
+#endif
+
+gboolean compressed_fill(struct compressed_file *cf) {
+  switch (cf->method) {
+#ifdef WITH_ZSTD
+  case COMPRESSION_ZSTD:
+    return zstd_fill(cf);
+#endif
+#ifdef WITH_LZ4
+  case COMPRESSION_LZ4:
+    return lz4_fill(cf);
+#endif
+  default:
+    cf->eof = TRUE;
+    return FALSE;
+  }
+}
+
+char *compressed_gets(void *file, char *buffer, int len) {
+  struct compressed_file *cf = file;
+  gsize n = 0, available;
+  gchar *newline;
+  if (cf->method == COMPRESSION_GZIP)
+    return gzgets(cf->gz, buffer, len);
+  while (n + 1 < (gsize)len) {
+    if (cf->out_pos == cf->out_len && !compressed_fill(cf))
+      break;
+    available = MIN(cf->out_len - cf->out_pos, len - 1 - n);
+    newline = memchr(cf->out_buffer + cf->out_pos, '\n', available);
+    if (newline)
+      available = newline - (cf->out_buffer + cf->out_pos) + 1;
+    memcpy(buffer + n, cf->out_buffer + cf->out_pos, available);
+    cf->out_pos += available;
+    n += available;
+    if (newline)
+      break;
+  }
+  if (!n)
+    return NULL;
+  buffer[n] = '\0';
+  return buffer;
+}
+
+gboolean compressed_eof(void *file) {
+  struct compressed_file *cf = file;
+  if (cf->method == COMPRESSION_GZIP)
+    return gzeof(cf->gz);
+  return cf->eof && cf->out_pos == cf->out_len;
+}
+
+void close_compressed_file(void *file) {
+  struct compressed_file *cf = file;
+  if (cf->gz)
+    gzclose(cf->gz);
+  if (cf->file)
+    fclose(cf->file);
+#ifdef WITH_ZSTD
+  if (cf->dctx)
+    ZSTD_freeDCtx(cf->dctx);
+#endif
+#ifdef WITH_LZ4
+  if (cf->lz4)
+    LZ4F_freeDecompressionContext(cf->lz4);
+#endif
+  g_free(cf->in_buffer);
+  g_free(cf->out_buffer);
+  g_free(cf);
+}
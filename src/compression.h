@@ -0,0 +1,57 @@
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Authors:        David Ducos, Percona (david dot ducos at percona dot com)
+*/
+
+#ifndef _src_compression_h
+#define _src_compression_h
+
+enum compression_method {
+  COMPRESSION_NONE,
+  COMPRESSION_GZIP,
+  COMPRESSION_ZSTD,
+  COMPRESSION_LZ4
+};
+
+void initialize_compression();
+gboolean parse_compression_method(const gchar *name,
+                                  enum compression_method *method);
+gboolean is_compression_method_available(enum compression_method method);
+const gchar *get_compression_extension(enum compression_method method);
+enum compression_method get_compression_method_for(const gchar *filename);
+gboolean is_compressed_filename(const gchar *filename);
+FILE *gzip_open(const char *filename, const char *mode);
+FILE *zstd_open(const char *filename, const char *mode);
+FILE *zstd_open_with_dictionary(const char *filename, const char *mode,
+                                void *dictionary);
+void *new_zstd_dictionary(const gchar *data, gsize len);
+gboolean register_zstd_dictionary(const gchar *filename);
+int zstd_write(FILE *file, const char *buff, int len);
+int zstd_close(void *file);
+void configure_zstd_context(void *cctx, gboolean use_workers);
+FILE *lz4_open(const char *filename, const char *mode);
+int lz4_write(FILE *file, const char *buff, int len);
+int lz4_close(void *file);
+void *new_lz4_context();
+void free_lz4_context(void *cctx);
+gsize lz4_frame_bound(gsize len);
+gsize lz4_compress_frame(void *cctx, gchar *out, gsize out_size,
+                         const gchar *first, gsize first_len,
+                         const gchar *second, gsize second_len);
+void *open_compressed_file(const gchar *filename);
+char *compressed_gets(void *file, char *buffer, int len);
+gboolean compressed_eof(void *file);
+void close_compressed_file(void *file);
+#endif
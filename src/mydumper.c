@@ -52,12 +52,17 @@ const char DIRECTORY[] = "export";
 gchar *output_directory = NULL;
 gchar *output_directory_param = NULL;
 gchar *dump_directory = NULL;
+// The data files are striped across them, the first one is output_directory
+gchar **output_directories = NULL;
+guint num_output_directories = 1;
 gboolean daemon_mode = FALSE;
 gchar *disk_limits=NULL;
 
 // For daemon mode
 gboolean shutdown_triggered = FALSE;
 
+extern gboolean load_data;
+
 guint errors;
 
 static GOptionEntry entries[] = {
@@ -162,15 +167,37 @@ int main(int argc, char *argv[]) {
   localtime_r(&t, &tval);
 
   char *datetimestr;
+  guint i;
 
   if (!output_directory_param){
     datetimestr=g_date_time_format(datetime,"\%Y\%m\%d-\%H\%M\%S");
     output_directory = g_strdup_printf("%s-%s", DIRECTORY, datetimestr);
     g_free(datetimestr);
+    output_directories = g_new0(gchar *, 2);
+    output_directories[0] = g_strdup(output_directory);
   }else{
-    output_directory=output_directory_param;
+    output_directories = g_strsplit(output_directory_param, ",", 0);
+    output_directory = g_strdup(output_directories[0]);
+  }
+  num_output_directories = g_strv_length(output_directories);
+  if (num_output_directories > 1 && daemon_mode){
+    g_critical("Several --outputdir are not supported in daemon mode");
+    exit(EXIT_FAILURE);
+  }
+  // LOAD DATA names the .dat files relative to the first directory
+  if (num_output_directories > 1 && load_data){
+    g_critical("Several --outputdir are not supported with --load-data");
+    exit(EXIT_FAILURE);
+  }
+  // Reject every bad entry before creating any directory
+  for (i = 0; i < num_output_directories; i++){
+    if (!strlen(output_directories[i])){
+      g_critical("Empty directory in --outputdir");
+      exit(EXIT_FAILURE);
+    }
   }
-  create_backup_dir(output_directory);
+  for (i = 0; i < num_output_directories; i++)
+    create_backup_dir(output_directories[i]);
   if (daemon_mode) {
     initialize_daemon_thread();
   }else{
@@ -192,6 +219,7 @@ int main(int argc, char *argv[]) {
   }
 
   g_free(output_directory);
+  g_strfreev(output_directories);
   g_strfreev(tables);
 
   if (logoutfile) {
@@ -0,0 +1,265 @@
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+        Authors:    David Ducos, Percona (david dot ducos at percona dot com)
+*/
+#include <mysql.h>
+#include <glib.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mydumper_common.h"
+#include "mydumper_database.h"
+#include "mydumper_catalog.h"
+
+extern gboolean order_by_primary_key;
+extern gboolean split_partitions;
+extern gboolean ignore_generated_fields;
+extern guint rows_per_file;
+extern guint64 chunk_target_bytes;
+extern char **tables;
+
+struct schema_catalog {
+  GMutex *mutex;
+  gboolean loaded;
+  GHashTable *tables;
+};
+
+GHashTable *catalog_hash = NULL;
+GMutex *catalog_mutex = NULL;
+
+void free_index_column(struct catalog_index_column *ic) {
+  g_free(ic->index_name);
+  g_free(ic->column);
+  g_free(ic);
+}
+
+void free_table_catalog(struct table_catalog *tc) {
+  g_list_free_full(tc->columns, g_free);
+  g_string_free(tc->insertable_fields, TRUE);
+  g_free(tc->primary_key);
+  g_list_free_full(tc->indexes, (GDestroyNotify)free_index_column);
+  g_list_free_full(tc->partitions, g_free);
+  g_free(tc);
+}
+
+void free_schema_catalog(struct schema_catalog *sc) {
+  g_hash_table_destroy(sc->tables);
+  g_mutex_free(sc->mutex);
+  g_free(sc);
+}
+
+void initialize_catalog() {
+  catalog_hash = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+                                       (GDestroyNotify)free_schema_catalog);
+  catalog_mutex = g_mutex_new();
+}
+
+/* Tables change between daemon snapshots */
+void clear_catalog() {
+  g_mutex_lock(catalog_mutex);
+  g_hash_table_remove_all(catalog_hash);
+  g_mutex_unlock(catalog_mutex);
+}
+
+struct table_catalog *get_or_create_table_catalog(struct schema_catalog *sc,
+                                                  char *table) {
+  struct table_catalog *tc = g_hash_table_lookup(sc->tables, table);
+  if (!tc) {
+    tc = g_new0(struct table_catalog, 1);
+    tc->insertable_fields = g_string_new("");
+    g_hash_table_insert(sc->tables, g_strdup(table), tc);
+  }
+  return tc;
+}
+
+MYSQL_RES *query_catalog(MYSQL *conn, gchar *query) {
+  MYSQL_RES *res = NULL;
+  if (mysql_query(conn, query))
+    g_warning("Could not load the catalog: %s", mysql_error(conn));
+  else
+    res = mysql_store_result(conn);
+  g_free(query);
+  return res;
+}
+
+/* Loads the columns, keys and partitions of every table of the schema, or
+ * only of table, with one query for each of them. */
+void load_catalog(MYSQL *conn, struct database *database,
+                  struct schema_catalog *sc, char *table) {
+  MYSQL_RES *res = NULL;
+  MYSQL_ROW row;
+  struct table_catalog *tc = NULL;
+  struct catalog_index_column *ic;
+  gchar *escaped_table = table ? escape_string(conn, table) : NULL;
+  gchar *filter = NULL, *query = NULL, *extra = NULL;
+  gchar *table_name = NULL;
+  gboolean done = FALSE;
+
+  /* Columns */
+  filter = escaped_table
+               ? g_strdup_printf(" AND TABLE_NAME='%s'", escaped_table)
+               : g_strdup("");
+  res = query_catalog(
+      conn, g_strdup_printf("SELECT TABLE_NAME, COLUMN_NAME, EXTRA FROM "
+                            "information_schema.COLUMNS WHERE "
+                            "TABLE_SCHEMA='%s'%s ORDER BY TABLE_NAME, "
+                            "ORDINAL_POSITION",
+                            database->escaped, filter));
+  while (res && (row = mysql_fetch_row(res))) {
+    tc = get_or_create_table_catalog(sc, row[0]);
+    tc->columns = g_list_append(tc->columns, g_strdup(row[1]));
+    extra = g_ascii_strup(row[2] ? row[2] : "", -1);
+    if (!ignore_generated_fields && strstr(extra, "GENERATED") &&
+        !strstr(extra, "DEFAULT_GENERATED"))
+      tc->has_generated_fields = TRUE;
+    if (!strstr(extra, "VIRTUAL GENERATED") &&
+        !strstr(extra, "STORED GENERATED"))
+      g_string_append_printf(tc->insertable_fields, "%s`%s`",
+                             tc->insertable_fields->len ? "," : "", row[1]);
+    g_free(extra);
+  }
+  if (res)
+    mysql_free_result(res);
+  g_free(filter);
+
+  /* Columns of the primary key, or the first unique key, to order by */
+  if (order_by_primary_key) {
+    filter = escaped_table
+                 ? g_strdup_printf(" AND t.table_name='%s'", escaped_table)
+                 : g_strdup("");
+    res = query_catalog(
+        conn,
+        g_strdup_printf("SELECT t.table_name, k.COLUMN_NAME, ORDINAL_POSITION "
+                        "FROM information_schema.table_constraints t "
+                        "LEFT JOIN information_schema.key_column_usage k "
+                        "USING(constraint_name,table_schema,table_name) "
+                        "WHERE t.constraint_type IN ('PRIMARY KEY', 'UNIQUE') "
+                        "AND t.table_schema='%s'%s "
+                        "ORDER BY t.table_name, t.constraint_type, "
+                        "ORDINAL_POSITION",
+                        database->escaped, filter));
+    tc = NULL;
+    while (res && (row = mysql_fetch_row(res))) {
+      if (!row[1])
+        continue;
+      if (!tc || strcmp(table_name, row[0])) {
+        g_free(table_name);
+        table_name = g_strdup(row[0]);
+        tc = get_or_create_table_catalog(sc, row[0]);
+        g_free(tc->primary_key);
+        tc->primary_key = g_strdup_printf("`%s`", row[1]);
+        done = FALSE;
+      } else if (!done && atoi(row[2]) > 1) {
+        gchar *primary_key =
+            g_strdup_printf("%s,`%s`", tc->primary_key, row[1]);
+        g_free(tc->primary_key);
+        tc->primary_key = primary_key;
+      } else {
+        done = TRUE;
+      }
+    }
+    if (res)
+      mysql_free_result(res);
+    g_free(table_name);
+    g_free(filter);
+  }
+
+  /* Indexes to pick the chunk key from, like SHOW INDEX */
+  if (rows_per_file || chunk_target_bytes) {
+    filter = escaped_table
+                 ? g_strdup_printf(" AND TABLE_NAME='%s'", escaped_table)
+                 : g_strdup("");
+    res = query_catalog(
+        conn,
+        g_strdup_printf("SELECT TABLE_NAME, NON_UNIQUE, INDEX_NAME, "
+                        "SEQ_IN_INDEX, COLUMN_NAME, CARDINALITY, SUB_PART, "
+                        "NULLABLE FROM information_schema.STATISTICS WHERE "
+                        "TABLE_SCHEMA='%s'%s ORDER BY TABLE_NAME, "
+                        "INDEX_NAME <> 'PRIMARY', INDEX_NAME, SEQ_IN_INDEX",
+                        database->escaped, filter));
+    while (res && (row = mysql_fetch_row(res))) {
+      tc = get_or_create_table_catalog(sc, row[0]);
+      ic = g_new0(struct catalog_index_column, 1);
+      ic->non_unique = row[1] && strcmp(row[1], "0");
+      ic->index_name = g_strdup(row[2]);
+      ic->seq_in_index = row[3] ? strtoul(row[3], NULL, 10) : 0;
+      ic->column = g_strdup(row[4]);
+      ic->cardinality = row[5] ? strtoull(row[5], NULL, 10) : 0;
+      ic->prefix = row[6] != NULL;
+      ic->nullable = row[7] && !strcmp(row[7], "YES");
+      tc->indexes = g_list_append(tc->indexes, ic);
+    }
+    if (res)
+      mysql_free_result(res);
+    g_free(filter);
+  }
+
+  if (split_partitions) {
+    filter = escaped_table
+                 ? g_strdup_printf(" AND TABLE_NAME='%s'", escaped_table)
+                 : g_strdup("");
+    query = g_strdup_printf("SELECT TABLE_NAME, PARTITION_NAME FROM "
+                            "information_schema.PARTITIONS WHERE "
+                            "PARTITION_NAME IS NOT NULL AND TABLE_SCHEMA='%s'%s "
+                            "ORDER BY TABLE_NAME, PARTITION_ORDINAL_POSITION, "
+                            "SUBPARTITION_ORDINAL_POSITION",
+                            database->escaped, filter);
+    /* Servers without partitioning have no PARTITIONS table */
+    res = mysql_query(conn, query) ? NULL : mysql_store_result(conn);
+    g_free(query);
+    while (res && (row = mysql_fetch_row(res))) {
+      tc = get_or_create_table_catalog(sc, row[0]);
+      tc->partitions = g_list_append(tc->partitions, g_strdup(row[1]));
+    }
+    if (res)
+      mysql_free_result(res);
+    g_free(filter);
+  }
+
+  g_free(escaped_table);
+}
+
+/* The schema is loaded the first time one of its tables is asked for. When
+ * only some tables are dumped, or the table was created after the schema was
+ * loaded, we load just the table. */
+struct table_catalog *get_table_catalog(MYSQL *conn, struct database *database,
+                                        char *table) {
+  struct schema_catalog *sc = NULL;
+  struct table_catalog *tc = NULL;
+
+  g_mutex_lock(catalog_mutex);
+  sc = g_hash_table_lookup(catalog_hash, database->name);
+  if (!sc) {
+    sc = g_new0(struct schema_catalog, 1);
+    sc->mutex = g_mutex_new();
+    sc->loaded = tables != NULL;
+    sc->tables = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+                                       (GDestroyNotify)free_table_catalog);
+    g_hash_table_insert(catalog_hash, g_strdup(database->name), sc);
+  }
+  g_mutex_unlock(catalog_mutex);
+
+  g_mutex_lock(sc->mutex);
+  if (!sc->loaded) {
+    load_catalog(conn, database, sc, NULL);
+    sc->loaded = TRUE;
+  }
+  tc = g_hash_table_lookup(sc->tables, table);
+  if (!tc) {
+    load_catalog(conn, database, sc, table);
+    tc = get_or_create_table_catalog(sc, table);
+  }
+  g_mutex_unlock(sc->mutex);
+  return tc;
+}
@@ -0,0 +1,43 @@
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+        Authors:    David Ducos, Percona (david dot ducos at percona dot com)
+*/
+
+// One column of an index, in the order SHOW INDEX returns them.
+struct catalog_index_column {
+  gchar *index_name;
+  gboolean non_unique;
+  guint seq_in_index;
+  gchar *column;
+  guint64 cardinality;
+  gboolean prefix;
+  gboolean nullable;
+};
+
+// What the job builders need to know about a table. It is loaded for the
+// whole schema at once and lives until the end of the dump.
+struct table_catalog {
+  GList *columns;
+  GString *insertable_fields;
+  gboolean has_generated_fields;
+  gchar *primary_key;
+  GList *indexes;
+  GList *partitions;
+};
+
+void initialize_catalog();
+void clear_catalog();
+struct table_catalog *get_table_catalog(MYSQL *conn, struct database *database,
+                                        char *table);
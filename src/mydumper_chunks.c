@@ -0,0 +1,1045 @@
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+        Authors:    Domas Mituzas, Facebook ( domas at fb dot com )
+                    Mark Leith, Oracle Corporation (mark dot leith at oracle dot com)
+                    Andrew Hutchings, SkySQL (andrew at skysql dot com)
+                    Max Bubenick, Percona RDBA (max dot bubenick at percona dot com)
+                    David Ducos, Percona (david dot ducos at percona dot com)
+*/
+#include <mysql.h>
+#include <glib.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mydumper_start_dump.h"
+#include "server_detect.h"
+#include "mydumper_database.h"
+#include "mydumper_catalog.h"
+#include "mydumper_chunks.h"
+#include "mydumper_scheduler.h"
+
+/* Columns that are hashed together to split a table without indexes */
+#define HASH_MAX_COLUMNS 8
+
+extern gchar *where_option;
+extern int detected_server;
+extern guint rows_per_file;
+extern guint64 max_rows;
+extern guint64 chunk_target_bytes;
+extern guint num_threads;
+extern gboolean daemon_mode;
+extern gchar *output_directory;
+extern guint chunk_plan_drift;
+
+guint64 estimate_count(MYSQL *conn, char *database, char *table,
+                       char *partition, char *field, char *from, char *to);
+struct table_job * new_table_job(struct db_table *dbt, char *partition, char *where, guint nchunk, char *order_by);
+
+GMutex *chunk_mutex = NULL;
+GList *stealable_table_jobs = NULL;
+char gipk_column[] = "my_row_id";
+GMutex *chunk_plan_mutex = NULL;
+GKeyFile *previous_chunk_plan = NULL;
+GKeyFile *chunk_plan = NULL;
+
+void initialize_chunk(){
+  chunk_mutex = g_mutex_new();
+  chunk_plan_mutex = g_mutex_new();
+}
+
+/* Key types that can be compared against the literals returned by
+ * get_chunk_key_literal in the same order the server sorts them. ENUM and SET
+ * are excluded as they sort by index but compare as strings. */
+gboolean is_sampleable_key_field(MYSQL_FIELD *field) {
+  if (field->flags & (ENUM_FLAG | SET_FLAG))
+    return FALSE;
+  switch (field->type) {
+  case MYSQL_TYPE_TINY:
+  case MYSQL_TYPE_SHORT:
+  case MYSQL_TYPE_LONG:
+  case MYSQL_TYPE_INT24:
+  case MYSQL_TYPE_LONGLONG:
+  case MYSQL_TYPE_DECIMAL:
+  case MYSQL_TYPE_NEWDECIMAL:
+  case MYSQL_TYPE_FLOAT:
+  case MYSQL_TYPE_DOUBLE:
+  case MYSQL_TYPE_YEAR:
+  case MYSQL_TYPE_DATE:
+  case MYSQL_TYPE_NEWDATE:
+  case MYSQL_TYPE_TIME:
+  case MYSQL_TYPE_DATETIME:
+  case MYSQL_TYPE_TIMESTAMP:
+  case MYSQL_TYPE_STRING:
+  case MYSQL_TYPE_VAR_STRING:
+  case MYSQL_TYPE_VARCHAR:
+  case MYSQL_TYPE_TINY_BLOB:
+  case MYSQL_TYPE_MEDIUM_BLOB:
+  case MYSQL_TYPE_LONG_BLOB:
+  case MYSQL_TYPE_BLOB:
+    return TRUE;
+  default:
+    return FALSE;
+  }
+}
+
+/* Numbers are used as they come, binary strings are hex encoded and
+ * everything else is escaped and quoted */
+gchar *get_chunk_key_literal(MYSQL *conn, MYSQL_FIELD *field, char *value,
+                             gulong length) {
+  gchar *literal = NULL;
+  if (field->flags & NUM_FLAG)
+    return g_strndup(value, length);
+  if (field->charsetnr == 63 && field->type != MYSQL_TYPE_DATE &&
+      field->type != MYSQL_TYPE_NEWDATE && field->type != MYSQL_TYPE_TIME &&
+      field->type != MYSQL_TYPE_DATETIME &&
+      field->type != MYSQL_TYPE_TIMESTAMP) {
+    if (length == 0)
+      return g_strdup("''");
+    literal = g_new(char, length * 2 + 3);
+    literal[0] = '0';
+    literal[1] = 'x';
+    mysql_hex_string(literal + 2, value, length);
+    return literal;
+  }
+  literal = g_new(char, length * 2 + 3);
+  literal[0] = '\'';
+  gulong escaped_length =
+      mysql_real_escape_string(conn, literal + 1, value, length);
+  literal[escaped_length + 1] = '\'';
+  literal[escaped_length + 2] = '\0';
+  return literal;
+}
+
+/* Returns the key of the row that is offset rows after condition, in key
+ * order, as a literal tuple. NULL means that there is no such row. */
+gchar *get_chunk_boundary(MYSQL *conn, char *database, char *table,
+                          char *partition, char *key_columns, guint key_count,
+                          char *condition, guint64 offset, gboolean *failed) {
+  MYSQL_RES *res = NULL;
+  MYSQL_ROW row;
+  gchar *boundary = NULL;
+  gchar *query = g_strdup_printf(
+      "SELECT %s %s FROM `%s`.`%s` %s %s %s %s %s ORDER BY %s LIMIT 1 OFFSET "
+      "%llu",
+      (detected_server == SERVER_TYPE_MYSQL) ? "/*!40001 SQL_NO_CACHE */" : "",
+      key_columns, database, table, partition ? partition : "",
+      (where_option || condition) ? "WHERE" : "",
+      where_option ? where_option : "",
+      (where_option && condition) ? "AND" : "",
+      condition ? condition : "", key_columns, (unsigned long long)offset);
+  if (mysql_query(conn, query) || !(res = mysql_store_result(conn))) {
+    g_warning("Unable to sample chunk boundaries for %s.%s: %s", database,
+              table, mysql_error(conn));
+    g_free(query);
+    *failed = TRUE;
+    return NULL;
+  }
+  g_free(query);
+
+  row = mysql_fetch_row(res);
+  if (row) {
+    MYSQL_FIELD *fields = mysql_fetch_fields(res);
+    gulong *lengths = mysql_fetch_lengths(res);
+    GString *tuple = g_string_new(key_count > 1 ? "(" : "");
+    guint i;
+    for (i = 0; i < key_count; i++) {
+      if (row[i] == NULL || !is_sampleable_key_field(&fields[i])) {
+        *failed = TRUE;
+        break;
+      }
+      gchar *literal = get_chunk_key_literal(conn, &fields[i], row[i], lengths[i]);
+      g_string_append_printf(tuple, "%s%s", i ? "," : "", literal);
+      g_free(literal);
+    }
+    if (key_count > 1)
+      g_string_append_c(tuple, ')');
+    boundary = g_string_free(tuple, *failed);
+  }
+  mysql_free_result(res);
+  return boundary;
+}
+
+/* Chunks of a table take the next part number. Chunks of a partition keep
+ * the part number of the partition and take the next sub part, which is
+ * shared with the files split by --chunk-filesize. */
+void set_chunk_part(struct table_job *tj) {
+  if (tj->sub_part_counter)
+    tj->sub_part = g_atomic_int_add(tj->sub_part_counter, 1);
+  else
+    tj->nchunk = tj->dbt->chunk_part++;
+}
+
+struct keyset_iterator *new_keyset_iterator(gchar *key_columns,
+                                            guint key_count,
+                                            gboolean nullable) {
+  struct keyset_iterator *ki = g_new0(struct keyset_iterator, 1);
+  ki->mutex = g_mutex_new();
+  ki->key_columns = g_strdup(key_columns);
+  ki->key_expr = key_count > 1 ? g_strdup_printf("(%s)", key_columns)
+                               : g_strdup(key_columns);
+  ki->key_count = key_count;
+  ki->nullable = nullable;
+  ki->boundary = NULL;
+  ki->done = FALSE;
+  return ki;
+}
+
+void free_keyset_iterator(struct keyset_iterator *ki) {
+  g_mutex_free(ki->mutex);
+  g_free(ki->key_columns);
+  g_free(ki->key_expr);
+  g_free(ki->boundary);
+  g_free(ki);
+}
+
+struct table_job_shared *new_table_job_shared(struct keyset_iterator *keyset,
+                                              gint *sub_part_counter) {
+  struct table_job_shared *shared = g_new0(struct table_job_shared, 1);
+  shared->keyset = keyset;
+  shared->sub_part_counter = sub_part_counter;
+  return shared;
+}
+
+void share_table_job(struct table_job *tj, struct table_job_shared *shared) {
+  g_atomic_int_inc(&shared->refs);
+  tj->shared = shared;
+  tj->keyset = shared->keyset;
+  tj->sub_part_counter = shared->sub_part_counter;
+}
+
+void release_table_job_shared(struct table_job_shared *shared) {
+  if (!g_atomic_int_dec_and_test(&shared->refs))
+    return;
+  if (shared->keyset)
+    free_keyset_iterator(shared->keyset);
+  g_free(shared->sub_part_counter);
+  g_free(shared);
+}
+
+/* Computes the next chunk of the table from the last boundary: the index is
+ * read from there up to chunk_rows rows, and the key found becomes the
+ * upper bound of this chunk and the lower bound of the next one. Every
+ * chunk has exactly chunk_rows rows, except the last one. If sampling
+ * fails half way, the rest of the table goes into this chunk. */
+gboolean get_next_keyset_chunk(MYSQL *conn, struct table_job *tj) {
+  struct keyset_iterator *ki = tj->keyset;
+  gboolean failed = FALSE;
+  gchar *from = NULL, *to = NULL, *condition = NULL;
+
+  g_free(tj->where);
+  tj->where = NULL;
+  g_mutex_lock(ki->mutex);
+  if (ki->done) {
+    g_mutex_unlock(ki->mutex);
+    return FALSE;
+  }
+  from = ki->boundary;
+  if (from)
+    condition = g_strdup_printf("%s >= %s", ki->key_expr, from);
+  else if (ki->nullable)
+    condition = g_strdup_printf("%s IS NOT NULL", ki->key_expr);
+  to = get_chunk_boundary(conn, tj->database, tj->table, tj->partition,
+                          ki->key_columns, ki->key_count, condition,
+                          tj->dbt->chunk_rows, &failed);
+  g_free(condition);
+  if (to && from && !strcmp(to, from)) {
+    /* More than chunk_rows rows share the same key, as it might happen
+     * on non unique indexes, we need to move to the next value */
+    g_free(to);
+    condition = g_strdup_printf("%s > %s", ki->key_expr, from);
+    to = get_chunk_boundary(conn, tj->database, tj->table, tj->partition,
+                            ki->key_columns, ki->key_count, condition, 0,
+                            &failed);
+    g_free(condition);
+  }
+  if (failed) {
+    g_free(to);
+    to = NULL;
+  }
+
+  if (from && to)
+    tj->where = g_strdup_printf("(%s >= %s AND %s < %s)", ki->key_expr, from,
+                                ki->key_expr, to);
+  else if (from)
+    tj->where = g_strdup_printf("(%s >= %s)", ki->key_expr, from);
+  else if (to)
+    tj->where = g_strdup_printf("(%s%s%s < %s)",
+                                ki->nullable ? ki->key_expr : "",
+                                ki->nullable ? " IS NULL OR " : "",
+                                ki->key_expr, to);
+  set_chunk_part(tj);
+  ki->boundary = to;
+  ki->done = to == NULL;
+  g_mutex_unlock(ki->mutex);
+  g_free(from);
+  return TRUE;
+}
+
+/* --chunk-target-bytes is translated to rows with the average row length
+ * that SHOW TABLE STATUS gave us, falling back to --rows */
+guint64 get_rows_per_chunk(struct db_table *dbt, guint64 rows) {
+  guint64 avg_row_length;
+  if (chunk_target_bytes && dbt->datalength && rows) {
+    avg_row_length = dbt->datalength / rows;
+    if (!avg_row_length)
+      avg_row_length = 1;
+    return chunk_target_bytes > avg_row_length
+               ? chunk_target_bytes / avg_row_length
+               : 1;
+  }
+  return rows_per_file;
+}
+
+guint64 get_range_step(guint64 width, guint64 range_steps) {
+  guint64 step = width / range_steps + 1;
+  return step > max_rows ? max_rows : step;
+}
+
+/* MySQL 8 keeps histograms in COLUMN_STATISTICS when they are created with
+ * ANALYZE TABLE ... UPDATE HISTOGRAM. Returns the values that split the
+ * column in n parts with about the same amount of rows, as exclusive upper
+ * bounds, or NULL if the column has no histogram. MySQL refuses histograms
+ * on columns with a single column unique index, so this only helps keys
+ * that are not unique, the others are kept even by the boundaries of
+ * get_next_integer_chunk. The ranges are unsigned, so histograms with
+ * negative values are not used. */
+GList *get_histogram_quantiles(MYSQL *conn, char *database, char *table,
+                               char *field, guint64 n) {
+  MYSQL_RES *res = NULL;
+  MYSQL_ROW row;
+  GList *quantiles = NULL;
+  guint64 k = 1, *quantile;
+  double frequency;
+  char *value;
+
+  if (detected_server != SERVER_TYPE_MYSQL || n < 2)
+    return NULL;
+
+  gchar *query = g_strdup_printf(
+      "SELECT JSON_UNQUOTE(JSON_EXTRACT(s.HISTOGRAM, '$.\"histogram-type\"')),"
+      " b.v0, b.v1, b.v2 FROM information_schema.COLUMN_STATISTICS s, "
+      "JSON_TABLE(s.HISTOGRAM, '$.buckets[*]' COLUMNS(v0 TEXT PATH '$[0]', "
+      "v1 TEXT PATH '$[1]', v2 TEXT PATH '$[2]')) b WHERE "
+      "s.SCHEMA_NAME='%s' AND s.TABLE_NAME='%s' AND s.COLUMN_NAME='%s'",
+      database, table, field);
+  if (mysql_query(conn, query) || !(res = mysql_store_result(conn))) {
+    /* No COLUMN_STATISTICS before 8.0 */
+    g_free(query);
+    return NULL;
+  }
+  g_free(query);
+
+  /* Buckets are [lower, upper, cumulative frequency, values] on equi-height
+   * histograms and [value, cumulative frequency] on singleton ones */
+  while ((row = mysql_fetch_row(res)) && k < n) {
+    if (!row[0])
+      continue;
+    if (!strcmp(row[0], "singleton")) {
+      value = row[1];
+      frequency = row[2] ? g_ascii_strtod(row[2], NULL) : 0;
+    } else {
+      value = row[2];
+      frequency = row[3] ? g_ascii_strtod(row[3], NULL) : 0;
+    }
+    if (value && value[0] == '-') {
+      g_list_free_full(quantiles, g_free);
+      quantiles = NULL;
+      break;
+    }
+    if (!value || frequency < (double)k / n)
+      continue;
+    quantile = g_new(guint64, 1);
+    *quantile = g_ascii_strtoull(value, NULL, 10) + 1;
+    quantiles = g_list_prepend(quantiles, quantile);
+    while (k < n && frequency >= (double)k / n)
+      k++;
+  }
+  mysql_free_result(res);
+  return g_list_reverse(quantiles);
+}
+
+/* MySQL 8.0.30 adds an invisible my_row_id primary key to the tables
+ * created without one when sql_generate_invisible_primary_key is ON */
+gboolean has_generated_invisible_primary_key(MYSQL *conn, char *database,
+                                             char *table) {
+  MYSQL_RES *res = NULL;
+  gboolean gipk = FALSE;
+
+  if (detected_server != SERVER_TYPE_MYSQL)
+    return FALSE;
+  gchar *query = g_strdup_printf("SELECT `%s` FROM `%s`.`%s` LIMIT 0",
+                                 gipk_column, database, table);
+  if (!mysql_query(conn, query) && (res = mysql_store_result(conn))) {
+    MYSQL_FIELD *fields = mysql_fetch_fields(res);
+    gipk = (fields[0].flags & PRI_KEY_FLAG) && (fields[0].flags & NUM_FLAG);
+    mysql_free_result(res);
+  }
+  g_free(query);
+  return gipk;
+}
+
+/* Tables without any index are split by the hash of their columns. One
+ * column might have a few values, like a status, and leave most chunks
+ * empty while each of them still reads the whole table, so up to
+ * HASH_MAX_COLUMNS of them are hashed together, numbers and dates first as
+ * they are cheaper. We only do it on tables bigger than a chunk and never
+ * with more chunks than threads. */
+GList *get_hash_chunks_for_table(MYSQL *conn, struct db_table *dbt,
+                                 char *partition) {
+  MYSQL_RES *res = NULL;
+  GList *chunks = NULL;
+  GString *columns = NULL;
+  gchar *hash = NULL;
+  guint64 rows, buckets, i;
+  guint j, ncolumns = 0;
+
+  rows = estimate_count(conn, dbt->database->name, dbt->table, partition,
+                        NULL, NULL, NULL);
+  if (!dbt->chunk_rows)
+    dbt->chunk_rows = get_rows_per_chunk(dbt, rows);
+  if (!dbt->chunk_rows || rows <= dbt->chunk_rows || num_threads < 2)
+    return NULL;
+
+  gchar *query = g_strdup_printf("SELECT * FROM `%s`.`%s` LIMIT 0",
+                                 dbt->database->name, dbt->table);
+  if (mysql_query(conn, query) || !(res = mysql_store_result(conn))) {
+    g_free(query);
+    return NULL;
+  }
+  g_free(query);
+
+  /* Every row has to fall in one chunk, and MOD(CRC32(NULL)) is NULL, so
+   * NULL is hashed as '' */
+  columns = g_string_new(NULL);
+  MYSQL_FIELD *fields = mysql_fetch_fields(res);
+  for (j = 0; j < mysql_num_fields(res) && ncolumns < HASH_MAX_COLUMNS; j++) {
+    switch (fields[j].type) {
+    case MYSQL_TYPE_TINY:
+    case MYSQL_TYPE_SHORT:
+    case MYSQL_TYPE_LONG:
+    case MYSQL_TYPE_INT24:
+    case MYSQL_TYPE_LONGLONG:
+    case MYSQL_TYPE_DECIMAL:
+    case MYSQL_TYPE_NEWDECIMAL:
+    case MYSQL_TYPE_DATE:
+    case MYSQL_TYPE_DATETIME:
+    case MYSQL_TYPE_TIMESTAMP:
+      g_string_append_printf(columns, "%sIFNULL(`%s`,'')", ncolumns ? "," : "",
+                             fields[j].name);
+      ncolumns++;
+      break;
+    default:
+      break;
+    }
+  }
+  for (j = 0; j < mysql_num_fields(res) && ncolumns < HASH_MAX_COLUMNS; j++) {
+    if ((fields[j].type == MYSQL_TYPE_STRING ||
+         fields[j].type == MYSQL_TYPE_VAR_STRING) &&
+        !(fields[j].flags & (ENUM_FLAG | SET_FLAG))) {
+      g_string_append_printf(columns, "%sIFNULL(`%s`,'')", ncolumns ? "," : "",
+                             fields[j].name);
+      ncolumns++;
+    }
+  }
+
+  if (ncolumns) {
+    hash = ncolumns > 1 ? g_strdup_printf("CRC32(CONCAT_WS(',',%s))", columns->str)
+                        : g_strdup_printf("CRC32(%s)", columns->str);
+    buckets = rows / dbt->chunk_rows + 1;
+    if (buckets > num_threads)
+      buckets = num_threads;
+    for (i = 0; i < buckets; i++)
+      chunks = g_list_prepend(
+          chunks, g_strdup_printf("MOD(%s,%llu) = %llu", hash,
+                                  (unsigned long long)buckets,
+                                  (unsigned long long)i));
+    chunks = g_list_reverse(chunks);
+    dbt->chunk_type = HASH;
+    g_free(hash);
+  }
+  g_string_free(columns, TRUE);
+  mysql_free_result(res);
+  return chunks;
+}
+
+GList *get_chunks_for_table(MYSQL *conn, struct db_table *dbt,
+                            char *partition, struct configuration *conf) {
+  char *database = dbt->database->name;
+  char *table = dbt->table;
+
+  GList *chunks = NULL, *index_iter = NULL;
+  MYSQL_RES *minmax = NULL, *total = NULL;
+  MYSQL_ROW row;
+  struct catalog_index_column *ic;
+  char *field = NULL;
+  char *key_name = NULL;
+  GString *key_columns = NULL;
+  guint key_count = 0;
+  gboolean nullable = FALSE;
+  gchar *query = NULL;
+
+  /* first have to pick index, in future should be able to preset in
+   * configuration too */
+  for (index_iter = dbt->catalog->indexes; index_iter != NULL;
+       index_iter = index_iter->next) {
+    ic = (struct catalog_index_column *)index_iter->data;
+    if (!strcmp(ic->index_name, "PRIMARY") && ic->seq_in_index == 1) {
+      /* Pick first column in PK, cardinality doesn't matter */
+      field = ic->column;
+      key_name = ic->index_name;
+      break;
+    }
+  }
+
+  /* If no PK found, try using first UNIQUE index */
+  for (index_iter = dbt->catalog->indexes; !field && index_iter != NULL;
+       index_iter = index_iter->next) {
+    ic = (struct catalog_index_column *)index_iter->data;
+    if (!ic->non_unique && ic->seq_in_index == 1 && ic->column) {
+      /* Again, first column of any unique index */
+      field = ic->column;
+      key_name = ic->index_name;
+    }
+  }
+
+  /* Still unlucky? Pick any high-cardinality index */
+  if (!field && conf->use_any_index) {
+    guint64 max_cardinality = 0;
+
+    for (index_iter = dbt->catalog->indexes; index_iter != NULL;
+         index_iter = index_iter->next) {
+      ic = (struct catalog_index_column *)index_iter->data;
+      if (ic->seq_in_index == 1 && ic->column &&
+          ic->cardinality > max_cardinality) {
+        field = ic->column;
+        key_name = ic->index_name;
+        max_cardinality = ic->cardinality;
+      }
+    }
+  }
+  /* The generated invisible primary key is hidden from STATISTICS when
+   * show_gipk_in_create_table_and_information_schema is OFF */
+  if (!field && has_generated_invisible_primary_key(conn, database, table))
+    field = gipk_column;
+
+  /* Oh well, no index to chunk on, try by hash */
+  if (!field) {
+    chunks = get_hash_chunks_for_table(conn, dbt, partition);
+    goto cleanup;
+  }
+
+  /* Collect the columns of the index that can be used as a tuple. We stop at
+   * prefix columns, as they don't sort on the whole value, and at nullable
+   * columns, as a NULL makes the whole tuple comparison NULL. A nullable
+   * first column is still usable on its own. */
+  key_columns = g_string_new("");
+  if (!key_name) {
+    g_string_append_printf(key_columns, "`%s`", field);
+    key_count++;
+  }
+  for (index_iter = key_name ? dbt->catalog->indexes : NULL;
+       index_iter != NULL; index_iter = index_iter->next) {
+    ic = (struct catalog_index_column *)index_iter->data;
+    if (strcmp(ic->index_name, key_name))
+      continue;
+    if (ic->prefix || !ic->column)
+      break;
+    if (ic->nullable) {
+      if (key_count)
+        break;
+      nullable = TRUE;
+    }
+    g_string_append_printf(key_columns, "%s`%s`", key_count ? "," : "",
+                           ic->column);
+    key_count++;
+    if (nullable)
+      break;
+  }
+
+  /* Get minimum/maximum */
+  mysql_query(conn, query = g_strdup_printf(
+                        "SELECT %s MIN(`%s`),MAX(`%s`) FROM `%s`.`%s` %s %s %s",
+                        (detected_server == SERVER_TYPE_MYSQL)
+                            ? "/*!40001 SQL_NO_CACHE */"
+                            : "",
+                        field, field, database, table, partition ? partition : "", where_option ? "WHERE" : "", where_option ? where_option : ""));
+  g_free(query);
+  minmax = mysql_store_result(conn);
+
+  if (!minmax)
+    goto cleanup;
+
+  row = mysql_fetch_row(minmax);
+  MYSQL_FIELD *fields = mysql_fetch_fields(minmax);
+
+  /* Check if all values are NULL */
+  if (row[0] == NULL)
+    goto cleanup;
+
+  char *min = row[0];
+  char *max = row[1];
+
+  guint64 estimated_chunks, estimated_step, nmin, nmax, cutoff, rows;
+  guint64 steps, ranges, range_steps, i;
+  GList *quantiles = NULL, *iter = NULL;
+  struct keyset_iterator *keyset = NULL;
+
+  /* Single column INT keys are split in ranges that can be split again by
+   * idle threads. Everything else is walked with a keyset iterator. */
+  switch (fields[0].type) {
+  case MYSQL_TYPE_LONG:
+  case MYSQL_TYPE_LONGLONG:
+  case MYSQL_TYPE_INT24:
+  case MYSQL_TYPE_SHORT:
+    if (key_count > 1)
+      goto sample;
+    /* Got total number of rows, skip chunk logic if estimates are low */
+    rows = estimate_count(conn, database, table, partition, field, min, max);
+    if (!dbt->chunk_rows)
+      dbt->chunk_rows = get_rows_per_chunk(dbt, rows);
+    if (!dbt->chunk_rows || rows <= dbt->chunk_rows)
+      goto cleanup;
+
+    /* This is estimate, not to use as guarantee! Every chunk would have eventual
+     * adjustments */
+    estimated_chunks = rows / dbt->chunk_rows;
+    /* The step is an estimate too, it is used to size and split the
+     * ranges, but the chunks end where the index says, see
+     * get_next_integer_chunk */
+    nmin = strtoul(min, NULL, 10);
+    nmax = strtoul(max, NULL, 10);
+    estimated_step = (nmax - nmin) / estimated_chunks + 1;
+    if (estimated_step > max_rows)
+      estimated_step = max_rows;
+    /* Every thread gets a range of steps instead of a job per step, the
+     * ranges that turn out to be dense are split later by steal_table_job */
+    steps = (nmax - nmin) / estimated_step + 1;
+    ranges = steps < num_threads ? steps : num_threads;
+    cutoff = nmin;
+    quantiles = get_histogram_quantiles(conn, database, table, field, ranges);
+    if (quantiles) {
+      /* Ranges with the same amount of rows, the key distribution might
+       * be skewed */
+      range_steps = estimated_chunks / ranges + 1;
+      for (iter = quantiles; iter != NULL; iter = iter->next) {
+        guint64 quantile = *((guint64 *)iter->data);
+        if (quantile <= cutoff || quantile > nmax)
+          continue;
+        chunks = g_list_prepend(
+            chunks, new_integer_step(field, cutoff == nmin, cutoff, quantile,
+                                     get_range_step(quantile - cutoff, range_steps)));
+        cutoff = quantile;
+      }
+      chunks = g_list_prepend(
+          chunks, new_integer_step(field, cutoff == nmin, cutoff, nmax + 1,
+                                   get_range_step(nmax + 1 - cutoff, range_steps)));
+      g_list_free_full(quantiles, g_free);
+    } else {
+      for (i = 0; i < ranges; i++) {
+        range_steps = steps / ranges + (i < steps % ranges ? 1 : 0);
+        chunks = g_list_prepend(
+            chunks, new_integer_step(field, cutoff == nmin, cutoff,
+                                     cutoff + range_steps * estimated_step,
+                                     estimated_step));
+        cutoff += range_steps * estimated_step;
+      }
+    }
+    chunks = g_list_reverse(chunks);
+    dbt->chunk_type = INTEGER;
+    goto cleanup;
+  default:
+  sample:
+    if (key_count == 0)
+      goto cleanup;
+    rows = estimate_count(conn, database, table, partition, field, NULL, NULL);
+    if (!dbt->chunk_rows)
+      dbt->chunk_rows = get_rows_per_chunk(dbt, rows);
+    if (!dbt->chunk_rows || rows <= dbt->chunk_rows)
+      goto cleanup;
+    /* Boundaries are computed on demand by the jobs, see
+     * get_next_keyset_chunk, we only need to decide how many of them */
+    keyset = new_keyset_iterator(key_columns->str, key_count, nullable);
+    dbt->chunk_type = SAMPLED;
+    ranges = rows / dbt->chunk_rows + 1;
+    if (ranges > num_threads)
+      ranges = num_threads;
+    for (i = 0; i < ranges; i++)
+      chunks = g_list_prepend(chunks, keyset);
+  }
+
+cleanup:
+  if (key_columns)
+    g_string_free(key_columns, TRUE);
+  if (minmax)
+    mysql_free_result(minmax);
+  if (total)
+    mysql_free_result(total);
+  return chunks;
+}
+
+struct integer_step *new_integer_step(gchar *field, gboolean include_null,
+                                      guint64 cursor, guint64 nmax,
+                                      guint64 step) {
+  struct integer_step *is = g_new0(struct integer_step, 1);
+  is->field = g_strdup(field);
+  is->include_null = include_null;
+  is->cursor = cursor;
+  is->nmax = nmax;
+  is->step = step;
+  return is;
+}
+
+void free_integer_step(struct integer_step *is) {
+  g_free(is->field);
+  g_free(is);
+}
+
+/* Only jobs that run inside the consistent snapshot can be split, as the
+ * thread that takes the second half might be a different one */
+void register_stealable_table_job(struct table_job *tj) {
+  g_mutex_lock(chunk_mutex);
+  stealable_table_jobs = g_list_prepend(stealable_table_jobs, tj);
+  g_mutex_unlock(chunk_mutex);
+}
+
+/* Moves the job to the next step of its range, setting where and nchunk.
+ * The end of the step is the key that is chunk_rows rows after the
+ * cursor, so sparse ranges don't produce empty chunks. The owner is the only
+ * one that moves the cursor, while it reads the index the range can only
+ * get shorter. Part numbers are given per table in the order the steps are
+ * taken, so they are unique no matter how the ranges were split. Returns
+ * FALSE when the range is exhausted. */
+gboolean get_next_integer_chunk(MYSQL *conn, struct table_job *tj) {
+  struct integer_step *is = tj->chunk_step;
+  guint64 from, to, nmax;
+  gboolean include_null, open_max, failed = FALSE;
+  gchar *key_column, *condition, *boundary;
+
+  g_free(tj->where);
+  tj->where = NULL;
+  g_mutex_lock(chunk_mutex);
+  if (is->cursor >= is->nmax) {
+    stealable_table_jobs = g_list_remove(stealable_table_jobs, tj);
+    g_mutex_unlock(chunk_mutex);
+    return FALSE;
+  }
+  from = is->cursor;
+  nmax = is->nmax;
+  g_mutex_unlock(chunk_mutex);
+
+  key_column = g_strdup_printf("`%s`", is->field);
+  condition = g_strdup_printf("%s >= %llu AND %s < %llu", key_column,
+                              (unsigned long long)from, key_column,
+                              (unsigned long long)nmax);
+  boundary = get_chunk_boundary(conn, tj->database, tj->table, tj->partition,
+                                key_column, 1, condition, tj->dbt->chunk_rows,
+                                &failed);
+  to = boundary ? g_ascii_strtoull(boundary, NULL, 10) : nmax;
+  /* Non unique indexes can have more than chunk_rows rows with the same
+   * value */
+  if (to <= from)
+    to = from + 1;
+  g_free(boundary);
+  g_free(condition);
+  g_free(key_column);
+
+  g_mutex_lock(chunk_mutex);
+  if (to > is->nmax)
+    to = is->nmax;
+  is->cursor = to;
+  include_null = is->include_null;
+  is->include_null = FALSE;
+  open_max = is->open_max && to == is->nmax;
+  set_chunk_part(tj);
+  g_mutex_unlock(chunk_mutex);
+
+  /* The where has to be set, chunks without one number their files by
+   * nchunk when they are split by --chunk-filesize */
+  if (include_null && open_max)
+    tj->where = g_strdup("1 = 1");
+  else if (include_null)
+    tj->where = g_strdup_printf("(`%s` IS NULL OR `%s` < %llu)", is->field,
+                                is->field, (unsigned long long)to);
+  else if (open_max)
+    tj->where = g_strdup_printf("`%s` >= %llu", is->field,
+                                (unsigned long long)from);
+  else
+    tj->where = g_strdup_printf("`%s` >= %llu AND `%s` < %llu", is->field,
+                                (unsigned long long)from, is->field,
+                                (unsigned long long)to);
+  return TRUE;
+}
+
+/* Splits the range with most steps pending and returns a new job for its
+ * second half, the owner keeps going until the new nmax. Returns NULL if
+ * no range has at least 2 steps left. */
+struct table_job *steal_table_job() {
+  struct table_job *victim = NULL, *tj = NULL;
+  struct integer_step *is = NULL;
+  guint64 pending, max_pending = 1, mid;
+  GList *iter;
+
+  g_mutex_lock(chunk_mutex);
+  for (iter = stealable_table_jobs; iter != NULL; iter = iter->next) {
+    is = ((struct table_job *)iter->data)->chunk_step;
+    pending = (is->nmax - is->cursor + is->step - 1) / is->step;
+    if (pending > max_pending &&
+        is_table_thread_available(((struct table_job *)iter->data)->dbt)) {
+      max_pending = pending;
+      victim = (struct table_job *)iter->data;
+    }
+  }
+  if (victim && acquire_table_thread(victim->dbt)) {
+    is = victim->chunk_step;
+    mid = is->cursor + (max_pending - max_pending / 2) * is->step;
+    tj = new_table_job(victim->dbt,
+                       victim->partition ? g_strdup(victim->partition) : NULL,
+                       NULL, victim->nchunk,
+                       victim->order_by ? g_strdup(victim->order_by) : NULL);
+    tj->chunk_step = new_integer_step(is->field, FALSE, mid, is->nmax, is->step);
+    tj->chunk_step->open_max = is->open_max;
+    if (victim->shared)
+      share_table_job(tj, victim->shared);
+    is->nmax = mid;
+    is->open_max = FALSE;
+    stealable_table_jobs = g_list_prepend(stealable_table_jobs, tj);
+  }
+  g_mutex_unlock(chunk_mutex);
+  return tj;
+}
+
+gboolean get_next_chunk(MYSQL *conn, struct table_job *tj) {
+  if (tj->chunk_step)
+    return get_next_integer_chunk(conn, tj);
+  if (tj->keyset)
+    return get_next_keyset_chunk(conn, tj);
+  return FALSE;
+}
+
+/* In daemon mode the chunks of every table are kept in the output directory,
+ * so the next snapshot doesn't have to compute them again */
+void load_chunk_plan() {
+  if (!daemon_mode)
+    return;
+  gchar *filename = g_build_filename(output_directory, "chunk_plan", NULL);
+  previous_chunk_plan = g_key_file_new();
+  if (!g_key_file_load_from_file(previous_chunk_plan, filename,
+                                 G_KEY_FILE_NONE, NULL)) {
+    g_key_file_free(previous_chunk_plan);
+    previous_chunk_plan = NULL;
+  }
+  g_free(filename);
+  chunk_plan = g_key_file_new();
+}
+
+void save_chunk_plan() {
+  GError *error = NULL;
+  gsize length;
+
+  if (!chunk_plan)
+    return;
+  gchar *filename = g_build_filename(output_directory, "chunk_plan", NULL);
+  gchar *data = g_key_file_to_data(chunk_plan, &length, NULL);
+  if (!g_file_set_contents(filename, data, length, &error)) {
+    g_warning("Could not write chunk plan %s: %s", filename, error->message);
+    g_error_free(error);
+  }
+  g_free(data);
+  g_free(filename);
+  g_key_file_free(chunk_plan);
+  chunk_plan = NULL;
+  if (previous_chunk_plan) {
+    g_key_file_free(previous_chunk_plan);
+    previous_chunk_plan = NULL;
+  }
+}
+
+/* The table is a group, and so is every partition that is chunked */
+gchar *get_chunk_plan_group(struct db_table *dbt, char *partition) {
+  return g_strstrip(g_strdup_printf("`%s`.`%s`%s", dbt->database->name,
+                                    dbt->table, partition ? partition : ""));
+}
+
+/* The plan of the previous snapshot is used while the estimated rows of the
+ * table stay within --chunk-plan-drift percent of the ones it was made with,
+ * and the table has the same partitions. Either way, the table is added to
+ * the new plan with the rows its chunks are based on. */
+gboolean use_cached_chunk_plan(struct db_table *dbt, GList *partitions) {
+  gchar **cached_partitions = NULL;
+  guint64 rows, drift;
+  gsize length = 0;
+  gboolean cached = FALSE;
+  GList *iter;
+  guint i;
+
+  if (!chunk_plan)
+    return FALSE;
+  gchar *group = get_chunk_plan_group(dbt, NULL);
+  g_mutex_lock(chunk_plan_mutex);
+  if (previous_chunk_plan &&
+      g_key_file_has_key(previous_chunk_plan, group, "rows", NULL)) {
+    rows = g_key_file_get_uint64(previous_chunk_plan, group, "rows", NULL);
+    drift = rows > dbt->estimated_rows ? rows - dbt->estimated_rows
+                                       : dbt->estimated_rows - rows;
+    cached = drift * 100 <= (guint64)chunk_plan_drift * (rows ? rows : 1);
+    if (g_key_file_has_key(previous_chunk_plan, group, "partitions", NULL))
+      cached_partitions = g_key_file_get_string_list(
+          previous_chunk_plan, group, "partitions", &length, NULL);
+    if (length != g_list_length(partitions))
+      cached = FALSE;
+    for (iter = partitions, i = 0; cached && iter != NULL;
+         iter = iter->next, i++)
+      if (strcmp(cached_partitions[i], (char *)iter->data))
+        cached = FALSE;
+    g_strfreev(cached_partitions);
+  }
+  if (cached) {
+    dbt->chunk_rows = g_key_file_get_uint64(previous_chunk_plan, group,
+                                            "chunk_rows", NULL);
+  } else
+    rows = dbt->estimated_rows;
+  g_key_file_set_uint64(chunk_plan, group, "rows", rows);
+  if (partitions) {
+    length = g_list_length(partitions);
+    cached_partitions = g_new0(gchar *, length + 1);
+    for (iter = partitions, i = 0; iter != NULL; iter = iter->next, i++)
+      cached_partitions[i] = (gchar *)iter->data;
+    g_key_file_set_string_list(chunk_plan, group, "partitions",
+                               (const gchar *const *)cached_partitions,
+                               length);
+    g_free(cached_partitions);
+  }
+  g_mutex_unlock(chunk_plan_mutex);
+  g_free(group);
+  return cached;
+}
+
+/* Rebuilds the chunks of get_chunks_for_table from the previous snapshot.
+ * Integer ranges are opened at both ends, as the key might have grown. */
+GList *get_cached_chunks_for_table(struct db_table *dbt, char *partition) {
+  GList *chunks = NULL;
+  struct integer_step *is = NULL;
+  struct keyset_iterator *keyset = NULL;
+  gchar **values = NULL, **range = NULL;
+  gsize length = 0, i;
+  gint jobs;
+
+  gchar *group = get_chunk_plan_group(dbt, partition);
+  g_mutex_lock(chunk_plan_mutex);
+  gchar *type = g_key_file_get_string(previous_chunk_plan, group, "type", NULL);
+  if (type && !strcmp(type, "integer")) {
+    gchar *field =
+        g_key_file_get_string(previous_chunk_plan, group, "field", NULL);
+    values = g_key_file_get_string_list(previous_chunk_plan, group, "ranges",
+                                        &length, NULL);
+    for (i = 0; field && i < length; i++) {
+      range = g_strsplit(values[i], ":", 3);
+      if (g_strv_length(range) == 3) {
+        is = new_integer_step(field, i == 0,
+                              g_ascii_strtoull(range[0], NULL, 10),
+                              g_ascii_strtoull(range[1], NULL, 10),
+                              g_ascii_strtoull(range[2], NULL, 10));
+        chunks = g_list_prepend(chunks, is);
+      }
+      g_strfreev(range);
+    }
+    if (is)
+      is->open_max = TRUE;
+    chunks = g_list_reverse(chunks);
+    dbt->chunk_type = INTEGER;
+    g_free(field);
+  } else if (type && !strcmp(type, "sampled")) {
+    gchar *key_columns =
+        g_key_file_get_string(previous_chunk_plan, group, "key_columns", NULL);
+    jobs = g_key_file_get_integer(previous_chunk_plan, group, "jobs", NULL);
+    if (key_columns && jobs > 0) {
+      keyset = new_keyset_iterator(
+          key_columns,
+          g_key_file_get_integer(previous_chunk_plan, group, "key_count", NULL),
+          g_key_file_get_boolean(previous_chunk_plan, group, "nullable", NULL));
+      for (; jobs > 0; jobs--)
+        chunks = g_list_prepend(chunks, keyset);
+      dbt->chunk_type = SAMPLED;
+    }
+    g_free(key_columns);
+  } else if (type && !strcmp(type, "hash")) {
+    values = g_key_file_get_string_list(previous_chunk_plan, group,
+                                        "conditions", &length, NULL);
+    for (i = 0; i < length; i++)
+      chunks = g_list_prepend(chunks, g_strdup(values[i]));
+    chunks = g_list_reverse(chunks);
+    dbt->chunk_type = HASH;
+  }
+  g_mutex_unlock(chunk_plan_mutex);
+  g_strfreev(values);
+  g_free(type);
+  g_free(group);
+  return chunks;
+}
+
+/* Adds the chunks of the table, or the partition, to the new plan. It has to
+ * be called before the jobs start moving the cursors. */
+void cache_chunks_for_table(struct db_table *dbt, char *partition,
+                            GList *chunks) {
+  struct integer_step *is;
+  struct keyset_iterator *keyset;
+  gchar **values;
+  GList *iter;
+  guint i;
+
+  if (!chunk_plan)
+    return;
+  gchar *table_group = get_chunk_plan_group(dbt, NULL);
+  gchar *group = get_chunk_plan_group(dbt, partition);
+  g_mutex_lock(chunk_plan_mutex);
+  g_key_file_set_uint64(chunk_plan, table_group, "chunk_rows", dbt->chunk_rows);
+  if (!chunks) {
+    g_key_file_set_string(chunk_plan, group, "type", "none");
+  } else if (dbt->chunk_type == INTEGER) {
+    is = (struct integer_step *)chunks->data;
+    g_key_file_set_string(chunk_plan, group, "type", "integer");
+    g_key_file_set_string(chunk_plan, group, "field", is->field);
+    values = g_new0(gchar *, g_list_length(chunks) + 1);
+    for (iter = chunks, i = 0; iter != NULL; iter = iter->next, i++) {
+      is = (struct integer_step *)iter->data;
+      values[i] = g_strdup_printf("%llu:%llu:%llu",
+                                  (unsigned long long)is->cursor,
+                                  (unsigned long long)is->nmax,
+                                  (unsigned long long)is->step);
+    }
+    g_key_file_set_string_list(chunk_plan, group, "ranges",
+                               (const gchar *const *)values, i);
+    g_strfreev(values);
+  } else if (dbt->chunk_type == SAMPLED) {
+    keyset = (struct keyset_iterator *)chunks->data;
+    g_key_file_set_string(chunk_plan, group, "type", "sampled");
+    g_key_file_set_string(chunk_plan, group, "key_columns",
+                          keyset->key_columns);
+    g_key_file_set_integer(chunk_plan, group, "key_count", keyset->key_count);
+    g_key_file_set_boolean(chunk_plan, group, "nullable", keyset->nullable);
+    g_key_file_set_integer(chunk_plan, group, "jobs", g_list_length(chunks));
+  } else if (dbt->chunk_type == HASH) {
+    values = g_new0(gchar *, g_list_length(chunks) + 1);
+    for (iter = chunks, i = 0; iter != NULL; iter = iter->next, i++)
+      values[i] = (gchar *)iter->data;
+    g_key_file_set_string(chunk_plan, group, "type", "hash");
+    g_key_file_set_string_list(chunk_plan, group, "conditions",
+                               (const gchar *const *)values, i);
+    g_free(values);
+  }
+  g_mutex_unlock(chunk_plan_mutex);
+  g_free(group);
+  g_free(table_group);
+}
@@ -0,0 +1,82 @@
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+        Authors:    David Ducos, Percona (david dot ducos at percona dot com)
+*/
+
+// A range of an integer key that is dumped one step at a time. The cursor is
+// the first value that has not been dumped yet and nmax is exclusive. Idle
+// threads can move nmax down and take the second half of the range. The
+// first step of the first range has no lower bound and, when open_max is set,
+// the last step has no upper bound, so a plan reused from a previous snapshot
+// still covers the whole key.
+struct integer_step {
+  gchar *field;
+  gboolean include_null;
+  gboolean open_max;
+  guint64 cursor;
+  guint64 nmax;
+  guint64 step;
+};
+
+// Chunks of tables that are not split by an integer key are computed while
+// the table is being dumped. The jobs of the table share the iterator and the
+// last boundary taken is the start of the next chunk.
+struct keyset_iterator {
+  GMutex *mutex;
+  gchar *key_columns;
+  gchar *key_expr;
+  guint key_count;
+  gboolean nullable;
+  gchar *boundary;
+  gboolean done;
+};
+
+// What the jobs of a table, or of one of its partitions, share: the keyset
+// iterator of sampled chunks and the sub part counter of a partition. Every
+// job, stolen ones included, holds a reference and the last one to finish
+// frees it.
+struct table_job_shared {
+  gint refs;
+  struct keyset_iterator *keyset;
+  gint *sub_part_counter;
+};
+
+void initialize_chunk();
+void load_chunk_plan();
+void save_chunk_plan();
+gboolean use_cached_chunk_plan(struct db_table *dbt, GList *partitions);
+GList *get_cached_chunks_for_table(struct db_table *dbt, char *partition);
+void cache_chunks_for_table(struct db_table *dbt, char *partition,
+                            GList *chunks);
+GList *get_chunks_for_table(MYSQL *conn, struct db_table *dbt,
+                            char *partition, struct configuration *conf);
+struct integer_step *new_integer_step(gchar *field, gboolean include_null,
+                                      guint64 cursor, guint64 nmax,
+                                      guint64 step);
+void free_integer_step(struct integer_step *is);
+guint64 get_rows_per_chunk(struct db_table *dbt, guint64 rows);
+void register_stealable_table_job(struct table_job *tj);
+struct keyset_iterator *new_keyset_iterator(gchar *key_columns,
+                                            guint key_count,
+                                            gboolean nullable);
+void free_keyset_iterator(struct keyset_iterator *ki);
+struct table_job_shared *new_table_job_shared(struct keyset_iterator *keyset,
+                                              gint *sub_part_counter);
+void share_table_job(struct table_job *tj, struct table_job_shared *shared);
+void release_table_job_shared(struct table_job_shared *shared);
+gboolean get_next_integer_chunk(MYSQL *conn, struct table_job *tj);
+gboolean get_next_keyset_chunk(MYSQL *conn, struct table_job *tj);
+gboolean get_next_chunk(MYSQL *conn, struct table_job *tj);
+struct table_job *steal_table_job();
@@ -0,0 +1,249 @@
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+        Authors:    David Ducos, Percona (david dot ducos at percona dot com)
+*/
+#include <mysql.h>
+#include <glib.h>
+#include <stdio.h>
+#include <string.h>
+#include "mydumper_masquerade.h"
+#include "mydumper_escape.h"
+#include "mydumper_column_plan.h"
+
+/* Some earlier versions of MySQL do not yet define MYSQL_TYPE_JSON */
+#ifndef MYSQL_TYPE_JSON
+#define MYSQL_TYPE_JSON 245
+#endif
+
+/* charsetnr of the binary character set */
+#define BINARY_CHARSET_NR 63
+
+extern gboolean load_data;
+extern gboolean hex_blob;
+extern gchar *fields_enclosed_by;
+
+void encode_sql_number(MYSQL *conn, gboolean fast_escape, GString *row,
+                       struct column_encoder *ce, gchar **column,
+                       gulong length) {
+  (void)conn;
+  (void)fast_escape;
+  (void)ce;
+  if (*column)
+    g_string_append_len(row, *column, length);
+  else
+    g_string_append(row, "NULL");
+}
+
+/* Dates and times never have a character that needs escaping */
+void encode_sql_temporal(MYSQL *conn, gboolean fast_escape, GString *row,
+                         struct column_encoder *ce, gchar **column,
+                         gulong length) {
+  (void)conn;
+  (void)fast_escape;
+  (void)ce;
+  if (*column) {
+    g_string_append_c(row, '\"');
+    g_string_append_len(row, *column, length);
+    g_string_append_c(row, '\"');
+  } else
+    g_string_append(row, "NULL");
+}
+
+void encode_sql_string(MYSQL *conn, gboolean fast_escape, GString *row,
+                       struct column_encoder *ce, gchar **column,
+                       gulong length) {
+  (void)ce;
+  if (*column) {
+    g_string_append_c(row, '\"');
+    append_escaped_string(conn, fast_escape, row, *column, length);
+    g_string_append_c(row, '\"');
+  } else
+    g_string_append(row, "NULL");
+}
+
+void encode_sql_json(MYSQL *conn, gboolean fast_escape, GString *row,
+                     struct column_encoder *ce, gchar **column, gulong length) {
+  (void)ce;
+  if (*column) {
+    g_string_append(row, "CONVERT(\"");
+    append_escaped_string(conn, fast_escape, row, *column, length);
+    g_string_append(row, "\" USING UTF8MB4)");
+  } else
+    g_string_append(row, "NULL");
+}
+
+void encode_load_data_number(MYSQL *conn, gboolean fast_escape, GString *row,
+                             struct column_encoder *ce, gchar **column,
+                             gulong length) {
+  (void)conn;
+  (void)fast_escape;
+  (void)ce;
+  if (*column)
+    g_string_append_len(row, *column, length);
+  else
+    g_string_append(row, "\\N");
+}
+
+void encode_load_data_temporal(MYSQL *conn, gboolean fast_escape, GString *row,
+                               struct column_encoder *ce, gchar **column,
+                               gulong length) {
+  (void)conn;
+  (void)fast_escape;
+  (void)ce;
+  if (*column) {
+    g_string_append(row, fields_enclosed_by);
+    g_string_append_len(row, *column, length);
+    g_string_append(row, fields_enclosed_by);
+  } else
+    g_string_append(row, "\\N");
+}
+
+void encode_load_data_string(MYSQL *conn, gboolean fast_escape, GString *row,
+                             struct column_encoder *ce, gchar **column,
+                             gulong length) {
+  (void)ce;
+  if (*column) {
+    g_string_append(row, fields_enclosed_by);
+    append_escaped_string(conn, fast_escape, row, *column, length);
+    g_string_append(row, fields_enclosed_by);
+  } else
+    g_string_append(row, "\\N");
+}
+
+/* 0x is not a valid literal, so empty values stay a quoted string */
+void encode_sql_hex(MYSQL *conn, gboolean fast_escape, GString *row,
+                    struct column_encoder *ce, gchar **column, gulong length) {
+  (void)conn;
+  (void)fast_escape;
+  (void)ce;
+  if (!*column)
+    g_string_append(row, "NULL");
+  else if (!length)
+    g_string_append(row, "''");
+  else {
+    g_string_append(row, "0x");
+    append_hex_string(row, *column, length);
+  }
+}
+
+/* The LOAD DATA statement reads it into a variable and UNHEX()es it */
+void encode_load_data_hex(MYSQL *conn, gboolean fast_escape, GString *row,
+                          struct column_encoder *ce, gchar **column,
+                          gulong length) {
+  (void)conn;
+  (void)fast_escape;
+  (void)ce;
+  if (*column) {
+    g_string_append(row, fields_enclosed_by);
+    append_hex_string(row, *column, length);
+    g_string_append(row, fields_enclosed_by);
+  } else
+    g_string_append(row, "\\N");
+}
+
+/* The masquerade functions work on C strings, so the length is taken again
+ * once the value has been replaced */
+void encode_masked(MYSQL *conn, gboolean fast_escape, GString *row,
+                   struct column_encoder *ce, gchar **column, gulong length) {
+  (void)length;
+  if (*column) {
+    gchar *value = ce->anonymize(column);
+    ce->base(conn, fast_escape, row, ce, &value, strlen(value));
+  } else
+    ce->base(conn, fast_escape, row, ce, column, 0);
+}
+
+gboolean is_temporal_field(MYSQL_FIELD *field) {
+  switch (field->type) {
+  case MYSQL_TYPE_TIMESTAMP:
+  case MYSQL_TYPE_DATE:
+  case MYSQL_TYPE_TIME:
+  case MYSQL_TYPE_DATETIME:
+  case MYSQL_TYPE_NEWDATE:
+    return TRUE;
+  default:
+    return FALSE;
+  }
+}
+
+/* BIT and the binary strings, which are dumped in hex with --hex-blob */
+gboolean is_hex_blob_field(MYSQL_FIELD *field) {
+  if (!hex_blob)
+    return FALSE;
+  switch (field->type) {
+  case MYSQL_TYPE_BIT:
+    return TRUE;
+  case MYSQL_TYPE_TINY_BLOB:
+  case MYSQL_TYPE_MEDIUM_BLOB:
+  case MYSQL_TYPE_LONG_BLOB:
+  case MYSQL_TYPE_BLOB:
+  case MYSQL_TYPE_VARCHAR:
+  case MYSQL_TYPE_VAR_STRING:
+  case MYSQL_TYPE_STRING:
+    return field->charsetnr == BINARY_CHARSET_NR;
+  default:
+    return FALSE;
+  }
+}
+
+/* The type checks are done once per column instead of for every cell */
+column_encoder_fn get_column_encoder(MYSQL_FIELD *field) {
+  if (is_hex_blob_field(field))
+    return load_data ? &encode_load_data_hex : &encode_sql_hex;
+  if (load_data) {
+    switch (field->type) {
+    case MYSQL_TYPE_LONG:
+    case MYSQL_TYPE_LONGLONG:
+    case MYSQL_TYPE_INT24:
+    case MYSQL_TYPE_SHORT:
+      return &encode_load_data_number;
+    default:
+      return is_temporal_field(field) ? &encode_load_data_temporal
+                                      : &encode_load_data_string;
+    }
+  }
+  /* Don't escape safe formats, saves some time */
+  if (field->flags & NUM_FLAG)
+    return &encode_sql_number;
+  if (field->type == MYSQL_TYPE_JSON)
+    return &encode_sql_json;
+  if (is_temporal_field(field))
+    return &encode_sql_temporal;
+  return &encode_sql_string;
+}
+
+struct column_plan *new_column_plan(GList *anonymized_function,
+                                    MYSQL_FIELD *fields, guint num_fields) {
+  struct column_plan *plan = g_new(struct column_plan, 1);
+  struct column_encoder *ce;
+  GList *f = anonymized_function;
+  guint i;
+
+  plan->num_columns = num_fields;
+  plan->encoders = g_new0(struct column_encoder, num_fields);
+  for (i = 0; i < num_fields; i++) {
+    ce = &plan->encoders[i];
+    ce->base = get_column_encoder(&fields[i]);
+    ce->encode = ce->base;
+    if (f) {
+      if (f->data != &identity_function) {
+        ce->anonymize = f->data;
+        ce->encode = &encode_masked;
+      }
+      f = f->next;
+    }
+  }
+  return plan;
+}
@@ -0,0 +1,39 @@
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+        Authors:    David Ducos, Percona (david dot ducos at percona dot com)
+*/
+
+struct column_encoder;
+
+typedef void (*column_encoder_fn)(MYSQL *conn, gboolean fast_escape,
+                                  GString *row, struct column_encoder *ce,
+                                  gchar **column, gulong length);
+
+// How one column of the result set is written. The encoder is picked once
+// from the MYSQL_FIELD, masked columns keep the type encoder in base.
+struct column_encoder {
+  column_encoder_fn encode;
+  column_encoder_fn base;
+  gchar *(*anonymize)(gchar **);
+};
+
+struct column_plan {
+  guint num_columns;
+  struct column_encoder *encoders;
+};
+
+gboolean is_hex_blob_field(MYSQL_FIELD *field);
+struct column_plan *new_column_plan(GList *anonymized_function,
+                                    MYSQL_FIELD *fields, guint num_fields);
@@ -29,7 +29,10 @@
 
 extern gchar *compress_extension;
 extern gchar *dump_directory;
+extern gchar **output_directories;
+extern guint num_output_directories;
 extern guint errors;
+extern GAsyncQueue *stream_queue;
 
 GMutex *ref_table_mutex = NULL;
 GHashTable *ref_table=NULL;
@@ -40,6 +43,44 @@ void initialize_common(){
   ref_table=g_hash_table_new ( g_str_hash, g_str_equal );
 }
 
+/* The files pending for --stream or --exec. The threads that push them wait
+ * while there are max_pending_stream_files, 0 is no limit. */
+static GMutex *stream_queue_mutex = NULL;
+static GCond *stream_queue_cond = NULL;
+static guint pending_stream_files = 0;
+static guint max_pending_stream_files = 0;
+
+void initialize_stream_queue(guint max_pending){
+  stream_queue = g_async_queue_new();
+  stream_queue_mutex = g_mutex_new();
+  stream_queue_cond = g_cond_new();
+  max_pending_stream_files = max_pending;
+}
+
+/* The empty filename that ends the queue is never held back */
+void stream_queue_push(const gchar *filename){
+  if (*filename){
+    g_mutex_lock(stream_queue_mutex);
+    while (max_pending_stream_files &&
+           pending_stream_files >= max_pending_stream_files)
+      g_cond_wait(stream_queue_cond, stream_queue_mutex);
+    pending_stream_files++;
+    g_mutex_unlock(stream_queue_mutex);
+  }
+  g_async_queue_push(stream_queue, g_strdup(filename));
+}
+
+gchar *stream_queue_pop(){
+  gchar *filename = g_async_queue_pop(stream_queue);
+  if (*filename){
+    g_mutex_lock(stream_queue_mutex);
+    pending_stream_files--;
+    g_cond_signal(stream_queue_cond);
+    g_mutex_unlock(stream_queue_mutex);
+  }
+  return filename;
+}
+
 char * determine_filename (char * table){
   // https://stackoverflow.com/questions/11794144/regular-expression-for-valid-filename
   // We might need to define a better filename alternatives
@@ -162,15 +203,25 @@ void set_transaction_isolation_level_repeatable_read(MYSQL *conn){
   }
 }
 
+static gint next_output_directory = 0;
+
+/* The data files go round-robin across the --outputdir directories, the
+ * rest of the files stay in the first one */
+const gchar *get_data_directory(){
+  if (num_output_directories < 2)
+    return dump_directory;
+  return output_directories[(guint)g_atomic_int_add(&next_output_directory, 1) % num_output_directories];
+}
+
 // Global Var used:
-// - dump_directory
+// - dump_directory, or the --outputdir directories
 // - compress_extension
 gchar * build_filename(char *database, char *table, guint part, guint sub_part, const gchar *extension){
   GString *filename = g_string_sized_new(20);
   sub_part == 0 ?
     g_string_append_printf(filename, "%s.%s.%05d.%s%s", database, table, part, extension, compress_extension):
     g_string_append_printf(filename, "%s.%s.%05d.%05d.%s%s", database, table, part, sub_part, extension, compress_extension);
-  gchar *r = g_build_filename(dump_directory, filename->str, NULL);
+  gchar *r = g_build_filename(get_data_directory(), filename->str, NULL);
   g_string_free(filename,TRUE);
   return r;
 }
@@ -19,6 +19,9 @@
                     David Ducos, Percona (david dot ducos at percona dot com)
 */
 void initialize_common();
+void initialize_stream_queue(guint max_pending);
+void stream_queue_push(const gchar *filename);
+gchar *stream_queue_pop();
 gchar *get_ref_table(gchar *k);
 char * determine_filename (char * table);
 char * escape_string(MYSQL *conn, char *str);
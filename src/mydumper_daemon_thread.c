@@ -32,6 +32,7 @@
 
 guint snapshot_interval = 60;
 guint snapshot_count= 2;
+guint chunk_plan_drift = 20;
 GMainLoop *m1;
 GAsyncQueue *start_scheduled_dump;
 guint dump_number=0;
@@ -46,6 +47,11 @@ static GOptionEntry daemon_entries[] = {
      "default 60",
      NULL},
     {"snapshot-count", 'X', 0, G_OPTION_ARG_INT, &snapshot_count, "number of snapshots, default 2", NULL},    
+    {"chunk-plan-drift", 0, 0, G_OPTION_ARG_INT, &chunk_plan_drift,
+     "Percentage the estimated rows of a table can change before its chunks "
+     "are computed again instead of reusing the ones of the previous "
+     "snapshot, requires --daemon, default 20",
+     NULL},
     {NULL, 0, 0, G_OPTION_ARG_NONE, NULL, NULL, NULL}};
 
 void load_daemon_entries(GOptionGroup *main_group){
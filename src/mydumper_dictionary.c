@@ -0,0 +1,149 @@
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+        Authors:    David Ducos, Percona (david dot ducos at percona dot com)
+*/
+#include <mysql.h>
+#include <glib.h>
+#include <stdio.h>
+#include <string.h>
+#ifdef WITH_ZSTD
+#include <zdict.h>
+#endif
+#include "mydumper_start_dump.h"
+#include "mydumper_common.h"
+#include "mydumper_database.h"
+#include "compression.h"
+#include "mydumper_stream.h"
+#include "mydumper_dictionary.h"
+
+/* Enough rows for a useful dictionary without leaving many files of the
+ * table compressed without it. A job samples at most the maximum, and the
+ * dictionary is trained once the table has the minimum. */
+#define DICTIONARY_SIZE (64 * 1024)
+#define DICTIONARY_SAMPLES_SIZE (16 * DICTIONARY_SIZE)
+#define DICTIONARY_MIN_SAMPLES_SIZE (8 * DICTIONARY_SIZE)
+
+extern gboolean stream;
+extern gboolean stream_diskless;
+
+gboolean compress_dictionary = FALSE;
+
+struct table_dictionary *new_table_dictionary() {
+  struct table_dictionary *td;
+  if (!compress_dictionary)
+    return NULL;
+  td = g_new0(struct table_dictionary, 1);
+  td->mutex = g_mutex_new();
+  td->samples = g_string_sized_new(0);
+  td->sample_sizes = g_array_new(FALSE, FALSE, sizeof(size_t));
+  return td;
+}
+
+/* NULL until the dictionary is trained */
+void *get_dictionary(struct db_table *dbt) {
+  return dbt->dictionary ? g_atomic_pointer_get(&dbt->dictionary->dictionary)
+                         : NULL;
+}
+
+struct dictionary_samples *start_dictionary_samples(struct db_table *dbt) {
+  struct dictionary_samples *ds = NULL;
+  if (!dbt->dictionary)
+    return NULL;
+  g_mutex_lock(dbt->dictionary->mutex);
+  if (!dbt->dictionary->done) {
+    ds = g_new(struct dictionary_samples, 1);
+    ds->data = g_string_sized_new(0);
+    ds->sizes = g_array_new(FALSE, FALSE, sizeof(size_t));
+  }
+  g_mutex_unlock(dbt->dictionary->mutex);
+  return ds;
+}
+
+/* Every row is a sample, they are what the files repeat */
+void add_dictionary_sample(struct dictionary_samples *ds, const gchar *row,
+                           gsize len) {
+  size_t size = len;
+  if (!ds || ds->data->len + len > DICTIONARY_SAMPLES_SIZE)
+    return;
+  g_string_append_len(ds->data, row, len);
+  g_array_append_val(ds->sizes, size);
+}
+
+#ifdef WITH_ZSTD
+void train_table_dictionary(struct db_table *dbt) {
+  struct table_dictionary *td = dbt->dictionary;
+  gchar *buffer = g_malloc(DICTIONARY_SIZE);
+  gchar *filename = NULL;
+  GError *error = NULL;
+  size_t len = ZDICT_trainFromBuffer(buffer, DICTIONARY_SIZE, td->samples->str,
+                                     (size_t *)td->sample_sizes->data,
+                                     td->sample_sizes->len);
+  if (ZDICT_isError(len)) {
+    g_message("No dictionary for %s.%s, %s", dbt->database->name, dbt->table,
+              ZDICT_getErrorName(len));
+    g_free(buffer);
+    return;
+  }
+  filename = build_meta_filename(dbt->database->filename, dbt->table_filename,
+                                 "dictionary");
+  /* myloader has to read it before the files that use it */
+  if (stream_diskless) {
+    gchar *name = g_path_get_basename(filename);
+    stream_block(name, g_string_new_len(buffer, len));
+    stream_end_of_file(name);
+    g_free(name);
+  } else if (!g_file_set_contents(filename, buffer, len, &error)) {
+    g_critical("Couldn't write dictionary file %s: %s", filename,
+               error->message);
+    g_error_free(error);
+    g_free(filename);
+    g_free(buffer);
+    return;
+  } else if (stream) {
+    stream_queue_push(filename);
+  }
+  g_atomic_pointer_set(&td->dictionary, new_zstd_dictionary(buffer, len));
+  g_free(filename);
+  g_free(buffer);
+}
+#endif
+
+/* The dictionary is trained by the job that completes the samples, and the
+ * files the others open after it use it */
+void end_dictionary_samples(struct db_table *dbt,
+                            struct dictionary_samples *ds) {
+  struct table_dictionary *td = dbt->dictionary;
+  if (!ds)
+    return;
+  g_mutex_lock(td->mutex);
+  if (!td->done) {
+    g_string_append_len(td->samples, ds->data->str, ds->data->len);
+    g_array_append_vals(td->sample_sizes, ds->sizes->data, ds->sizes->len);
+    if (td->samples->len >= DICTIONARY_MIN_SAMPLES_SIZE) {
+#ifdef WITH_ZSTD
+      train_table_dictionary(dbt);
+#endif
+      td->done = TRUE;
+      g_string_free(td->samples, TRUE);
+      g_array_free(td->sample_sizes, TRUE);
+      td->samples = NULL;
+      td->sample_sizes = NULL;
+    }
+  }
+  g_mutex_unlock(td->mutex);
+  g_string_free(ds->data, TRUE);
+  g_array_free(ds->sizes, TRUE);
+  g_free(ds);
+}
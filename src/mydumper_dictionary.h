@@ -0,0 +1,40 @@
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+        Authors:    David Ducos, Percona (david dot ducos at percona dot com)
+*/
+
+// The zstd dictionary of a table. It is trained from the rows of the first
+// files of the table and the files opened after that are compressed with it.
+struct table_dictionary {
+  GMutex *mutex;
+  GString *samples;
+  GArray *sample_sizes;
+  void *dictionary;
+  gboolean done;
+};
+
+// The rows one job sampled, handed to the table when its file is closed
+struct dictionary_samples {
+  GString *data;
+  GArray *sizes;
+};
+
+struct table_dictionary *new_table_dictionary();
+void *get_dictionary(struct db_table *dbt);
+struct dictionary_samples *start_dictionary_samples(struct db_table *dbt);
+void add_dictionary_sample(struct dictionary_samples *ds, const gchar *row,
+                           gsize len);
+void end_dictionary_samples(struct db_table *dbt,
+                            struct dictionary_samples *ds);
@@ -0,0 +1,150 @@
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+        Authors:    David Ducos, Percona (david dot ducos at percona dot com)
+*/
+#include <mysql.h>
+#include <glib.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "mydumper_escape.h"
+
+/* The escapes mysql_real_escape_string uses for these bytes, written
+ * straight into the row. The character that follows the backslash, or 0 if
+ * the byte is copied as is. */
+static const char escape_table[256] = {
+    ['\0'] = '0', ['\n'] = 'n',  ['\r'] = 'r',  ['\\'] = '\\',
+    ['\''] = '\'', ['"'] = '"', ['\032'] = 'Z'};
+
+/* mysql_real_escape_string skips the bytes of multibyte characters, which
+ * in some charsets can be a backslash or a quote. We only escape byte by
+ * byte when no byte of a multibyte character can be one of them, and when
+ * the server doesn't use NO_BACKSLASH_ESCAPES, as quotes are doubled
+ * then.
+ *
+ * The output is not always byte identical. With utf8, libmysql also puts a
+ * backslash before the lead byte of an invalid multibyte sequence, common
+ * in BLOB and BINARY values, and we copy that byte as is. The server reads
+ * both as the same value: a backslash before a byte that is not an escape
+ * is dropped, and as no byte of a utf8 sequence is ASCII, every byte that
+ * needs escaping is escaped either way. */
+gboolean can_use_fast_escape(MYSQL *conn) {
+  MY_CHARSET_INFO cs;
+  if (conn->server_status & SERVER_STATUS_NO_BACKSLASH_ESCAPES)
+    return FALSE;
+  mysql_get_character_set_info(conn, &cs);
+  return cs.mbmaxlen == 1 || !g_ascii_strncasecmp(cs.csname, "utf8", 4);
+}
+
+#ifdef __SSE2__
+/* Returns a mask with a bit set for every byte of the 16 at from that has
+ * to be escaped */
+static inline int escape_mask(const gchar *from) {
+  __m128i chunk = _mm_loadu_si128((const __m128i *)from);
+  __m128i found = _mm_cmpeq_epi8(chunk, _mm_setzero_si128());
+  found = _mm_or_si128(found, _mm_cmpeq_epi8(chunk, _mm_set1_epi8('\n')));
+  found = _mm_or_si128(found, _mm_cmpeq_epi8(chunk, _mm_set1_epi8('\r')));
+  found = _mm_or_si128(found, _mm_cmpeq_epi8(chunk, _mm_set1_epi8('\\')));
+  found = _mm_or_si128(found, _mm_cmpeq_epi8(chunk, _mm_set1_epi8('\'')));
+  found = _mm_or_si128(found, _mm_cmpeq_epi8(chunk, _mm_set1_epi8('"')));
+  found = _mm_or_si128(found, _mm_cmpeq_epi8(chunk, _mm_set1_epi8('\032')));
+  return _mm_movemask_epi8(found);
+}
+#endif
+
+void append_escaped_string(MYSQL *conn, gboolean fast_escape, GString *dest,
+                           const gchar *from, gulong length) {
+  gsize len = dest->len;
+  const gchar *end = from + length;
+  gchar *to;
+  char c;
+
+  /* Every byte can take 2 */
+  g_string_set_size(dest, len + length * 2 + 1);
+  to = dest->str + len;
+  if (!fast_escape) {
+    g_string_truncate(dest, len + mysql_real_escape_string(conn, to, from,
+                                                           length));
+    return;
+  }
+
+#ifdef __SSE2__
+  /* Blocks without anything to escape are copied 16 bytes at a time. The
+   * input has at least 16 bytes left, so there is room for them in the
+   * output too. */
+  while (end - from >= 16) {
+    int mask = escape_mask(from);
+    if (!mask) {
+      _mm_storeu_si128((__m128i *)to,
+                       _mm_loadu_si128((const __m128i *)from));
+      from += 16;
+      to += 16;
+      continue;
+    }
+    int skip = __builtin_ctz(mask);
+    memcpy(to, from, skip);
+    to += skip;
+    from += skip;
+    *to++ = '\\';
+    *to++ = escape_table[(unsigned char)*from++];
+  }
+#endif
+  for (; from < end; from++) {
+    c = escape_table[(unsigned char)*from];
+    if (c) {
+      *to++ = '\\';
+      *to++ = c;
+    } else
+      *to++ = *from;
+  }
+  g_string_truncate(dest, to - dest->str);
+}
+
+#ifdef __SSE2__
+/* Turns 16 nibbles into their uppercase hex digits */
+static inline __m128i hex_digits(__m128i nibbles) {
+  __m128i letters = _mm_and_si128(_mm_cmpgt_epi8(nibbles, _mm_set1_epi8(9)),
+                                  _mm_set1_epi8('A' - '0' - 10));
+  return _mm_add_epi8(_mm_add_epi8(nibbles, _mm_set1_epi8('0')), letters);
+}
+#endif
+
+/* Two uppercase hex digits for every byte, like mysqldump --hex-blob */
+void append_hex_string(GString *dest, const gchar *from, gulong length) {
+  static const char digits[] = "0123456789ABCDEF";
+  gsize len = dest->len;
+  const gchar *end = from + length;
+  gchar *to;
+
+  g_string_set_size(dest, len + length * 2);
+  to = dest->str + len;
+#ifdef __SSE2__
+  while (end - from >= 16) {
+    __m128i chunk = _mm_loadu_si128((const __m128i *)from);
+    __m128i low_nibble = _mm_set1_epi8(0x0f);
+    __m128i high = hex_digits(_mm_and_si128(_mm_srli_epi16(chunk, 4), low_nibble));
+    __m128i low = hex_digits(_mm_and_si128(chunk, low_nibble));
+    _mm_storeu_si128((__m128i *)to, _mm_unpacklo_epi8(high, low));
+    _mm_storeu_si128((__m128i *)(to + 16), _mm_unpackhi_epi8(high, low));
+    from += 16;
+    to += 32;
+  }
+#endif
+  for (; from < end; from++) {
+    *to++ = digits[(unsigned char)*from >> 4];
+    *to++ = digits[(unsigned char)*from & 0x0f];
+  }
+}
@@ -17,64 +17,165 @@
 #include "string.h"
 #include <mysql.h>
 #include <glib/gstdio.h>
-#ifdef ZWRAP_USE_ZSTD
-#include "../zstd/zstd_zlibwrapper.h"
-#else
-#include <zlib.h>
-#endif
 #include <stdlib.h>
 #include <glib.h>
+#include <glib-unix.h>
 #include <stdio.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
 #include "common.h"
+#include "mydumper_common.h"
+#include "mydumper_exec_command.h"
 #include <sys/wait.h>
 
-extern FILE * (*m_open)(const char *filename, const char *);
-extern gchar *compress_extension;
-extern GAsyncQueue *stream_queue;
 extern gboolean no_delete;
-
-GThread *exec_command_thread = NULL;
 extern gchar *exec_command;
+extern guint errors;
+
+/* --exec-threads commands run at the same time, and the dump threads wait
+ * when twice as many files are waiting for them */
+guint exec_threads = 4;
+guint exec_retries = 0;
+/* The command reads the file from its standard input, and the data files are
+ * piped to it as they are made instead of being written */
+gboolean exec_stdin = FALSE;
+
+GThread **exec_command_threads = NULL;
+static gchar **exec_arguments = NULL;
+
+/* The command on filename, with input as its standard input when it is not
+ * -1. Returns its pid, or -1. */
+GPid spawn_exec_command(const gchar *filename, int input){
+  guint i, n = g_strv_length(exec_arguments);
+  gchar **c_arg = g_new0(gchar *, n + 1);
+  GPid childpid;
+  for(i=0; i<n; i++)
+    c_arg[i] = g_strcmp0(exec_arguments[i], "FILENAME") == 0 ? (gchar *)filename : exec_arguments[i];
+  childpid=vfork();
+  if (!childpid){
+    if (input >= 0 && dup2(input, 0) < 0)
+      _exit(127);
+    execv(c_arg[0], c_arg);
+    _exit(127);
+  }
+  g_free(c_arg);
+  return childpid;
+}
+
+/* The status as wait() returns it, or -1 when the command could not run */
+int wait_exec_command(GPid childpid){
+  int status = -1;
+  if (childpid < 0 || waitpid(childpid, &status, 0) < 0)
+    return -1;
+  return status;
+}
+
+gboolean exec_command_succeeded(int status){
+  return status != -1 && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+void report_exec_command_failure(int status, const gchar *filename){
+  if (status == -1)
+    g_critical("Command could not be executed on %s", filename);
+  else if (!WIFEXITED(status))
+    g_critical("Command was terminated by signal %d on %s", WTERMSIG(status), filename);
+  else
+    g_critical("Command failed with exit status %d on %s", WEXITSTATUS(status), filename);
+  errors++;
+}
+
+int run_exec_command(gchar *filename){
+  int input = -1, status;
+  if (exec_stdin){
+    input = g_open(filename, O_RDONLY | O_CLOEXEC, 0);
+    if (input < 0)
+      return -1;
+  }
+  status = wait_exec_command(spawn_exec_command(filename, input));
+  if (input >= 0)
+    close(input);
+  return status;
+}
+
+/* With --exec-stdin every data file gets a command of its own, and what is
+ * written to the descriptor returned is its standard input. Both ends of the
+ * pipe are close-on-exec, so the commands of other files do not keep it
+ * open. */
+int start_exec_command(const gchar *filename, GPid *childpid){
+  int fds[2];
+  GError *error = NULL;
+  if (!g_unix_open_pipe(fds, FD_CLOEXEC, &error)){
+    g_critical("Could not create a pipe for %s: %s", filename, error->message);
+    g_error_free(error);
+    return -1;
+  }
+  *childpid = spawn_exec_command(filename, fds[0]);
+  close(fds[0]);
+  if (*childpid < 0){
+    close(fds[1]);
+    return -1;
+  }
+  return fds[1];
+}
+
+/* Called once its input is closed, FALSE when it failed */
+gboolean finish_exec_command(GPid childpid, const gchar *filename){
+  int status = wait_exec_command(childpid);
+  if (exec_command_succeeded(status))
+    return TRUE;
+  report_exec_command_failure(status, filename);
+  return FALSE;
+}
 
+/* The file is kept when the command fails on it */
 void *process_exec_command(void *data){
   (void)data;
-  gchar *space=g_strstr_len(exec_command,-1," ");
-  guint len = strlen(exec_command) - strlen(space);
   char * filename=NULL;
-  char * bin=g_strndup(exec_command,len);
-  gchar ** arguments=g_strsplit(space," ", 0);
-  gchar ** volatile c_arg=NULL;
-  guint i=0;
+  guint retry;
+  int status;
   for(;;){
-    filename=(char *)g_async_queue_pop(stream_queue);
+    filename=stream_queue_pop();
     if (strlen(filename) == 0){
+      // the other threads have to see it too
+      stream_queue_push(filename);
+      g_free(filename);
       break;
     }
-    char *used_filemame=g_path_get_basename(filename);
-    g_strfreev(c_arg);
-    c_arg=g_strdupv(arguments);
-    for(i=0; i<g_strv_length(c_arg); i++){
-      if (g_strcmp0(c_arg[i],"FILENAME") == 0)
-        c_arg[i]=filename;
+    for (retry=0; ; retry++){
+      status = run_exec_command(filename);
+      if (exec_command_succeeded(status) || retry == exec_retries)
+        break;
+      g_warning("Command failed on %s, retrying", filename);
     }
-    int childpid=vfork();
-    if(!childpid)
-      i=execv(bin,c_arg);
-    wait(&childpid);
-    free(used_filemame);
-    if (no_delete == FALSE)
+    if (!exec_command_succeeded(status))
+      report_exec_command_failure(status, filename);
+    else if (no_delete == FALSE)
       remove(filename);
+    g_free(filename);
   }
   return NULL;
 }
 
 void initialize_exec_command(){
+  guint i;
   g_message("Initializing Execcommand");
-  stream_queue = g_async_queue_new();
-  exec_command_thread = g_thread_create((GThreadFunc)process_exec_command, stream_queue, TRUE, NULL);
+  if (!exec_threads)
+    exec_threads = 1;
+  exec_arguments = g_strsplit(exec_command, " ", 0);
+  // A command that exits early makes the writes to its pipe fail instead
+  if (exec_stdin)
+    signal(SIGPIPE, SIG_IGN);
+  initialize_stream_queue(2 * exec_threads);
+  exec_command_threads = g_new(GThread *, exec_threads);
+  for (i=0; i<exec_threads; i++)
+    exec_command_threads[i] = g_thread_create((GThreadFunc)process_exec_command, NULL, TRUE, NULL);
 }
 
 void wait_exec_command_to_finish(){
-  g_thread_join(exec_command_thread);
+  guint i;
+  for (i=0; i<exec_threads; i++)
+    g_thread_join(exec_command_threads[i]);
+  g_free(exec_command_threads);
+  g_strfreev(exec_arguments);
 }
@@ -18,4 +18,6 @@
 
 void initialize_exec_command();
 void wait_exec_command_to_finish();
+int start_exec_command(const gchar *filename, GPid *childpid);
+gboolean finish_exec_command(GPid childpid, const gchar *filename);
 //void *process_stream(void *data);
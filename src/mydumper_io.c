@@ -0,0 +1,412 @@
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+        Authors:    David Ducos, Percona (david dot ducos at percona dot com)
+*/
+#define _GNU_SOURCE
+#include <mysql.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#ifdef WITH_IO_URING
+#include <sys/uio.h>
+#include <liburing.h>
+#endif
+#include "common.h"
+#include "mydumper_io.h"
+
+extern guint errors;
+
+gchar *io_backend = NULL;
+gboolean direct_io = FALSE;
+
+/* The file is opened with fopen when its blocks are compressed by us */
+gboolean write_raw(FILE *file, const gchar *data, gsize len) {
+  gsize written = 0;
+  int r = 0;
+  while (written < len) {
+    r = write_file(file, (char *)data + written, len - written);
+    if (r <= 0) {
+      g_critical("Couldn't write data to a file: %s", strerror(errno));
+      errors++;
+      return FALSE;
+    }
+    written += r;
+  }
+  return TRUE;
+}
+
+gboolean stdio_start() {
+  return TRUE;
+}
+
+void *stdio_open(const char *filename, const char *mode) {
+  return g_fopen(filename, mode);
+}
+
+gboolean stdio_write(void *file, const gchar *data, gsize len) {
+  return write_raw(file, data, len);
+}
+
+gboolean stdio_close(void *file) {
+  if (fclose(file)) {
+    g_critical("Couldn't close a file: %s", strerror(errno));
+    errors++;
+    return FALSE;
+  }
+  return TRUE;
+}
+
+void stdio_stop() {}
+
+struct output_backend stdio_output_backend = {
+    "stdio", stdio_start, stdio_open, stdio_write, stdio_close, stdio_stop};
+
+#ifdef WITH_IO_URING
+/* O_DIRECT needs the memory, the offset and the length of every write
+ * aligned to the logical block size of the disk, which is at most this */
+#define URING_ALIGNMENT 4096
+#define URING_BUFFER_SIZE (1024 * 1024)
+/* Every write in flight has a buffer, so they are also the queue depth */
+#define URING_BUFFERS 64
+
+struct uring_file {
+  int fd;
+  gchar *filename;
+  guint64 offset;
+  gboolean direct;
+  // With O_DIRECT, the bytes after the last whole block, which go with the
+  // next write or, at close, without O_DIRECT
+  gchar *tail;
+  gsize tail_len;
+  // Writes in flight, under uring_mutex
+  guint pending;
+  gint failed;
+};
+
+struct uring_request {
+  struct uring_file *file;
+  guint buffer;
+  gsize length;
+  gsize written;
+  guint64 offset;
+};
+
+struct io_uring uring;
+gboolean uring_registered = FALSE;
+struct iovec *uring_buffers = NULL;
+GAsyncQueue *uring_free_buffers = NULL;
+GAsyncQueue *uring_requests = NULL;
+GMutex *uring_mutex = NULL;
+GCond *uring_cond = NULL;
+GThread *uring_submit_thread = NULL;
+
+/* Buffers are pushed as index + 1, as a queue does not take NULL */
+guint uring_pop_buffer() {
+  return GPOINTER_TO_UINT(g_async_queue_pop(uring_free_buffers)) - 1;
+}
+
+void uring_push_buffer(guint buffer) {
+  g_async_queue_push(uring_free_buffers, GUINT_TO_POINTER(buffer + 1));
+}
+
+void uring_prepare(struct uring_request *r) {
+  struct io_uring_sqe *sqe = io_uring_get_sqe(&uring);
+  gchar *data = (gchar *)uring_buffers[r->buffer].iov_base + r->written;
+  if (uring_registered)
+    io_uring_prep_write_fixed(sqe, r->file->fd, data, r->length - r->written,
+                              r->offset + r->written, r->buffer);
+  else
+    io_uring_prep_write(sqe, r->file->fd, data, r->length - r->written,
+                        r->offset + r->written);
+  io_uring_sqe_set_data(sqe, r);
+}
+
+/* FALSE when the write was short and the rest of it goes again */
+gboolean uring_complete(struct uring_request *r, int res) {
+  struct uring_file *f = r->file;
+  if (res > 0 && (gsize)res < r->length - r->written) {
+    r->written += res;
+    uring_prepare(r);
+    return FALSE;
+  }
+  if (res <= 0) {
+    g_critical("Couldn't write data to %s: %s", f->filename,
+               res ? strerror(-res) : "nothing was written");
+    errors++;
+    g_atomic_int_set(&f->failed, 1);
+  }
+  uring_push_buffer(r->buffer);
+  g_free(r);
+  g_mutex_lock(uring_mutex);
+  f->pending--;
+  g_cond_broadcast(uring_cond);
+  g_mutex_unlock(uring_mutex);
+  return TRUE;
+}
+
+/* The writes that are waiting when the ring has room go in one submission,
+ * and it waits for them only when there is nothing else to submit */
+void *uring_thread(gpointer data) {
+  struct uring_request *r;
+  struct io_uring_cqe *cqe;
+  guint in_flight = 0;
+  gboolean stopping = FALSE;
+  int res;
+  (void)data;
+  while (!stopping || in_flight) {
+    while (!stopping && in_flight < URING_BUFFERS) {
+      r = in_flight ? g_async_queue_try_pop(uring_requests)
+                    : g_async_queue_pop(uring_requests);
+      if (!r)
+        break;
+      if (!r->file) {
+        g_free(r);
+        stopping = TRUE;
+        break;
+      }
+      uring_prepare(r);
+      in_flight++;
+    }
+    if (!in_flight)
+      continue;
+    res = io_uring_submit_and_wait(&uring, 1);
+    if (res < 0 && res != -EINTR && res != -EAGAIN && res != -EBUSY) {
+      g_critical("Could not submit the writes to io_uring: %s",
+                 strerror(-res));
+      exit(EXIT_FAILURE);
+    }
+    while (io_uring_peek_cqe(&uring, &cqe) == 0) {
+      r = io_uring_cqe_get_data(cqe);
+      res = cqe->res;
+      io_uring_cqe_seen(&uring, cqe);
+      if (uring_complete(r, res))
+        in_flight--;
+    }
+  }
+  return NULL;
+}
+
+gboolean uring_start() {
+  guint n;
+  int res = io_uring_queue_init(URING_BUFFERS, &uring, 0);
+  if (res < 0) {
+    g_warning("Could not set up io_uring: %s", strerror(-res));
+    return FALSE;
+  }
+  uring_buffers = g_new(struct iovec, URING_BUFFERS);
+  uring_free_buffers = g_async_queue_new();
+  for (n = 0; n < URING_BUFFERS; n++) {
+    if (posix_memalign(&uring_buffers[n].iov_base, URING_ALIGNMENT,
+                       URING_BUFFER_SIZE)) {
+      g_critical("Could not allocate the io_uring buffers");
+      exit(EXIT_FAILURE);
+    }
+    uring_buffers[n].iov_len = URING_BUFFER_SIZE;
+    uring_push_buffer(n);
+  }
+  /* Registered buffers are mapped once instead of on every write. Older
+   * kernels count them in RLIMIT_MEMLOCK, without it they are not. */
+  res = io_uring_register_buffers(&uring, uring_buffers, URING_BUFFERS);
+  uring_registered = res == 0;
+  if (!uring_registered)
+    g_message("io_uring buffers not registered: %s", strerror(-res));
+  uring_requests = g_async_queue_new();
+  uring_mutex = g_mutex_new();
+  uring_cond = g_cond_new();
+  uring_submit_thread =
+      g_thread_create((GThreadFunc)uring_thread, NULL, TRUE, NULL);
+  return TRUE;
+}
+
+/* The offsets are ours, so "a" starts at the end of the file instead of
+ * using O_APPEND, which would ignore them */
+void *uring_open(const char *filename, const char *mode) {
+  struct uring_file *f;
+  struct stat st;
+  int flags = O_WRONLY | O_CREAT | O_CLOEXEC | (mode[0] == 'a' ? 0 : O_TRUNC);
+  int fd = -1;
+  gboolean direct = direct_io;
+  if (direct) {
+    fd = open(filename, flags | O_DIRECT, 0666);
+    /* Some filesystems, like tmpfs, do not take O_DIRECT */
+    if (fd < 0 && errno == EINVAL)
+      direct = FALSE;
+  }
+  if (!direct)
+    fd = open(filename, flags, 0666);
+  if (fd < 0)
+    return NULL;
+  f = g_new0(struct uring_file, 1);
+  f->fd = fd;
+  f->filename = g_strdup(filename);
+  if (mode[0] == 'a' && !fstat(fd, &st))
+    f->offset = st.st_size;
+  if (direct && f->offset % URING_ALIGNMENT) {
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_DIRECT);
+    direct = FALSE;
+  }
+  f->direct = direct;
+  if (direct)
+    f->tail = g_malloc(URING_ALIGNMENT);
+  return f;
+}
+
+/* The data is copied to the buffers, so the writer threads go on with the
+ * next block while it is written */
+gboolean uring_write(void *file, const gchar *data, gsize len) {
+  struct uring_file *f = file;
+  struct uring_request *r;
+  gchar *buffer;
+  gsize n, copy, keep;
+  while (len) {
+    if (g_atomic_int_get(&f->failed))
+      return FALSE;
+    if (f->direct && f->tail_len + len < URING_ALIGNMENT) {
+      memcpy(f->tail + f->tail_len, data, len);
+      f->tail_len += len;
+      return TRUE;
+    }
+    r = g_new0(struct uring_request, 1);
+    r->file = f;
+    r->buffer = uring_pop_buffer();
+    buffer = uring_buffers[r->buffer].iov_base;
+    memcpy(buffer, f->tail, f->tail_len);
+    n = f->tail_len;
+    f->tail_len = 0;
+    copy = MIN(len, URING_BUFFER_SIZE - n);
+    memcpy(buffer + n, data, copy);
+    n += copy;
+    data += copy;
+    len -= copy;
+    if (f->direct) {
+      keep = n % URING_ALIGNMENT;
+      n -= keep;
+      memcpy(f->tail, buffer + n, keep);
+      f->tail_len = keep;
+    }
+    r->length = n;
+    r->offset = f->offset;
+    f->offset += n;
+    g_mutex_lock(uring_mutex);
+    f->pending++;
+    g_mutex_unlock(uring_mutex);
+    g_async_queue_push(uring_requests, r);
+  }
+  return !g_atomic_int_get(&f->failed);
+}
+
+/* The last bytes are not a whole block, so they are written without
+ * O_DIRECT once the rest is on disk */
+gboolean uring_write_tail(struct uring_file *f) {
+  gsize written = 0;
+  ssize_t r;
+  if (fcntl(f->fd, F_SETFL, fcntl(f->fd, F_GETFL) & ~O_DIRECT))
+    return FALSE;
+  while (written < f->tail_len) {
+    r = pwrite(f->fd, f->tail + written, f->tail_len - written,
+               f->offset + written);
+    if (r <= 0)
+      return FALSE;
+    written += r;
+  }
+  return TRUE;
+}
+
+gboolean uring_close(void *file) {
+  struct uring_file *f = file;
+  gboolean ok;
+  g_mutex_lock(uring_mutex);
+  while (f->pending)
+    g_cond_wait(uring_cond, uring_mutex);
+  g_mutex_unlock(uring_mutex);
+  if (f->tail_len && !g_atomic_int_get(&f->failed) && !uring_write_tail(f)) {
+    g_critical("Couldn't write data to %s: %s", f->filename, strerror(errno));
+    errors++;
+    g_atomic_int_set(&f->failed, 1);
+  }
+  if (close(f->fd)) {
+    g_critical("Couldn't close %s: %s", f->filename, strerror(errno));
+    errors++;
+    g_atomic_int_set(&f->failed, 1);
+  }
+  ok = !g_atomic_int_get(&f->failed);
+  g_free(f->tail);
+  g_free(f->filename);
+  g_free(f);
+  return ok;
+}
+
+/* Every file has been closed by then */
+void uring_stop() {
+  guint n;
+  g_async_queue_push(uring_requests, g_new0(struct uring_request, 1));
+  g_thread_join(uring_submit_thread);
+  if (uring_registered)
+    io_uring_unregister_buffers(&uring);
+  io_uring_queue_exit(&uring);
+  for (n = 0; n < URING_BUFFERS; n++)
+    free(uring_buffers[n].iov_base);
+  g_free(uring_buffers);
+  g_async_queue_unref(uring_free_buffers);
+  g_async_queue_unref(uring_requests);
+  g_mutex_free(uring_mutex);
+  g_cond_free(uring_cond);
+}
+
+struct output_backend uring_output_backend = {
+    "io_uring", uring_start, uring_open, uring_write, uring_close, uring_stop};
+#endif
+
+struct output_backend *output_backend = &stdio_output_backend;
+
+void initialize_output_backend() {
+  if (!io_backend || !g_strcmp0(io_backend, "stdio")) {
+    output_backend = &stdio_output_backend;
+  } else if (!g_strcmp0(io_backend, "io_uring")) {
+#ifdef WITH_IO_URING
+    output_backend = &uring_output_backend;
+#else
+    g_critical("io_uring support is not built in");
+    exit(EXIT_FAILURE);
+#endif
+  } else {
+    g_critical("Unknown I/O backend: %s", io_backend);
+    exit(EXIT_FAILURE);
+  }
+  if (direct_io && output_backend == &stdio_output_backend) {
+    g_critical("--direct-io needs --io-backend=io_uring");
+    exit(EXIT_FAILURE);
+  }
+}
+
+/* Without io_uring in the kernel, or allowed in the container, the files
+ * are still written */
+void start_output_backend() {
+  if (!output_backend->start()) {
+    g_warning("Writing the data files with %s instead of %s",
+              stdio_output_backend.name, output_backend->name);
+    output_backend = &stdio_output_backend;
+  }
+}
+
+void stop_output_backend() {
+  output_backend->stop();
+}
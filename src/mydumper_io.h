@@ -0,0 +1,33 @@
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+        Authors:    David Ducos, Percona (david dot ducos at percona dot com)
+*/
+
+// Where the writer threads write the blocks of the data files. stdio writes
+// them with the thread, io_uring hands them to a thread that submits them in
+// batches.
+struct output_backend {
+  const gchar *name;
+  gboolean (*start)();
+  void *(*open)(const char *filename, const char *mode);
+  gboolean (*write)(void *file, const gchar *data, gsize len);
+  gboolean (*close)(void *file);
+  void (*stop)();
+};
+
+gboolean write_raw(FILE *file, const gchar *data, gsize len);
+void initialize_output_backend();
+void start_output_backend();
+void stop_output_backend();
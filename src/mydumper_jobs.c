@@ -32,7 +32,10 @@
 #include "regex.h"
 #include "mydumper_common.h"
 #include "mydumper_jobs.h"
+#include "mydumper_chunks.h"
+#include "mydumper_scheduler.h"
 #include "mydumper_database.h"
+#include "mydumper_catalog.h"
 extern gchar *where_option;
 extern gboolean success_on_1146;
 extern int detected_server;
@@ -42,7 +45,6 @@ extern guint errors;
 extern guint statement_size;
 extern int skip_tz;
 extern gchar *set_names_str;
-extern GAsyncQueue *stream_queue;
 extern gboolean stream;
 extern gboolean dump_routines;
 extern gboolean dump_events;
@@ -54,7 +56,16 @@ gboolean dump_triggers = FALSE;
 gboolean split_partitions = FALSE;
 gboolean order_by_primary_key = FALSE;
 guint64 max_rows=1000000;
+guint64 chunk_target_bytes=0;
 gboolean ignore_generated_fields = FALSE;
+guint max_queued_jobs = 200000;
+guint max_threads_per_table = 0;
+GMutex *job_queue_mutex = NULL;
+GCond *job_queue_cond = NULL;
+GPrivate *job_queue_consumer_key = NULL;
+gint job_queue_consumers = 0;
+gint job_queue_waiting_producers = 0;
+gint job_queue_waiting_consumers = 0;
 
 extern gboolean schema_checksums;
 extern gboolean routine_checksums;
@@ -63,9 +74,18 @@ static GOptionEntry dump_into_file_entries[] = {
     {"triggers", 'G', 0, G_OPTION_ARG_NONE, &dump_triggers, "Dump triggers. By default, it do not dump triggers",
      NULL},
     { "split-partitions", 0, 0, G_OPTION_ARG_NONE, &split_partitions,
-      "Dump partitions into separate files. This options overrides the --rows option for partitioned tables.", NULL},
+      "Dump partitions into separate files. With --rows, each partition is split in chunks too.", NULL},
+    {"max-queued-jobs", 0, 0, G_OPTION_ARG_INT, &max_queued_jobs,
+     "Maximum number of jobs in the queue, the threads that create them wait "
+     "until it is drained to half of it, default 200000", NULL},
+    {"max-threads-per-table", 0, 0, G_OPTION_ARG_INT, &max_threads_per_table,
+     "Maximum number of threads dumping the same table at the same time, "
+     "default 0 (no limit)", NULL},
     {"max-rows", 0, 0, G_OPTION_ARG_INT64, &max_rows,
      "Limit the number of rows per block after the table is estimated, default 1000000", NULL},
+    {"chunk-target-bytes", 0, 0, G_OPTION_ARG_INT64, &chunk_target_bytes,
+     "Split tables into chunks of about this many bytes. The rows per chunk are "
+     "calculated from the average row length of each table and overrides --rows", NULL},
     { "no-check-generated-fields", 0, 0, G_OPTION_ARG_NONE, &ignore_generated_fields,
       "Queries related to generated fields are not going to be executed."
       "It will lead to restoration issues if you have generated columns", NULL },
@@ -80,6 +100,14 @@ void load_dump_into_file_entries(GOptionGroup *main_group){
 
 void initialize_dump_into_file(){
   initialize_database();
+  initialize_catalog();
+  initialize_scheduler();
+  job_queue_mutex = g_mutex_new();
+  job_queue_cond = g_cond_new();
+  job_queue_consumer_key = g_private_new(NULL);
+  if (max_queued_jobs < 2)
+    max_queued_jobs = 2;
+  initialize_chunk();
   if (ignore_generated_fields)
     g_warning("Queries related to generated fields are not going to be executed. It will lead to restoration issues if you have generated columns");
 }
@@ -104,7 +132,7 @@ void write_checksum_into_file(MYSQL *conn, char *database, char *table, char *fi
   fprintf(outfile, "%s", checksum);
   fclose(outfile);
 
-  if (stream) g_async_queue_push(stream_queue, g_strdup(filename));
+  if (stream) stream_queue_push(filename);
   g_free(checksum);
 
   return;
@@ -120,7 +148,7 @@ void write_table_metadata_into_file(struct db_table * dbt){
   }
   fprintf(table_meta, "%d", dbt->rows);
   fclose(table_meta);
-  if (stream) g_async_queue_push(stream_queue, g_strdup(filename));
+  if (stream) stream_queue_push(filename);
 }
 
 gchar * get_tablespace_query(){
@@ -217,7 +245,7 @@ void write_schema_definition_into_file(MYSQL *conn, char *database, char *filena
   g_free(query);
 
   m_close(outfile);
-  if (stream) g_async_queue_push(stream_queue, g_strdup(filename));
+  if (stream) stream_queue_push(filename);
   g_string_free(statement, TRUE);
   if (result)
     mysql_free_result(result);
@@ -293,7 +321,7 @@ void write_table_definition_into_file(MYSQL *conn, char *database, char *table,
   g_free(query);
 
   m_close(outfile);
-  if (stream) g_async_queue_push(stream_queue, g_strdup(filename));
+  if (stream) stream_queue_push(filename);
   g_string_free(statement, TRUE);
   if (result)
     mysql_free_result(result);
@@ -364,7 +392,7 @@ void write_triggers_definition_into_file(MYSQL *conn, char *database, char *tabl
   }
   g_free(query);
   m_close(outfile);
-  if (stream) g_async_queue_push(stream_queue, g_strdup(filename));
+  if (stream) stream_queue_push(filename);
   g_string_free(statement, TRUE);
   g_strfreev(splited_st);
   if (result)
@@ -477,9 +505,9 @@ void write_view_definition_into_file(MYSQL *conn, char *database, char *table, c
   g_free(query);
   m_close(outfile);
 
-  if (stream) g_async_queue_push(stream_queue, g_strdup(filename));
+  if (stream) stream_queue_push(filename);
   m_close(outfile2);
-  if (stream) g_async_queue_push(stream_queue, g_strdup(filename2));
+  if (stream) stream_queue_push(filename2);
   g_string_free(statement, TRUE);
   if (result)
     mysql_free_result(result);
@@ -651,7 +679,7 @@ void write_routines_definition_into_file(MYSQL *conn, struct database *database,
 
   g_free(query);
   m_close(outfile);
-  if (stream) g_async_queue_push(stream_queue, g_strdup(filename));
+  if (stream) stream_queue_push(filename);
   g_string_free(statement, TRUE);
   g_strfreev(splited_st);
   if (result)
@@ -785,7 +813,7 @@ void create_job_to_dump_tablespaces(MYSQL *conn, struct configuration *conf){
   j->conf = conf;
   j->type = JOB_CREATE_TABLESPACE;
   ctj->filename = build_tablespace_filename();
-  g_async_queue_push(conf->queue, j);
+  m_async_queue_push_conservative(conf->queue, j);
   return;
 }
 
@@ -801,7 +829,7 @@ void create_job_to_dump_schema(char *database, struct configuration *conf) {
   cdj->filename = build_schema_filename(d, "schema-create");
   if (schema_checksums)
     cdj->checksum_filename = build_meta_filename(database,NULL,"schema-create-checksum"); 
-  g_async_queue_push(conf->queue, j);
+  m_async_queue_push_conservative(conf->queue, j);
   return;
 }
 
@@ -828,7 +856,7 @@ void create_job_to_dump_triggers(MYSQL *conn, struct db_table *dbt, struct confi
         st->filename = build_schema_table_filename(dbt->database->filename, dbt->table_filename, "schema-triggers");
         if ( routine_checksums )
           st->checksum_filename=build_meta_filename(dbt->database->filename,dbt->table_filename,"schema-triggers-checksum");
-        g_async_queue_push(conf->queue, t);
+        m_async_queue_push_conservative(conf->queue, t);
       }
     }
     g_free(query);
@@ -850,7 +878,10 @@ void create_job_to_dump_table_schema(struct db_table *dbt, struct configuration
   sj->filename = build_schema_table_filename(dbt->database->filename, dbt->table_filename, "schema");
   if ( schema_checksums )
     sj->checksum_filename=build_meta_filename(dbt->database->filename,dbt->table_filename,"schema-checksum");
-  g_async_queue_push(queue, j);
+  if (queue == conf->queue)
+    m_async_queue_push_conservative(queue, j);
+  else
+    g_async_queue_push(queue, j);
 }
 
 void create_job_to_dump_view(struct db_table *dbt, struct configuration *conf) {
@@ -865,7 +896,7 @@ void create_job_to_dump_view(struct db_table *dbt, struct configuration *conf) {
   vj->filename2 = build_schema_table_filename(dbt->database->filename, dbt->table_filename, "schema-view");
   if ( schema_checksums )
     vj->checksum_filename = build_meta_filename(dbt->database->filename, dbt->table_filename, "schema-view-checksum");
-  g_async_queue_push(conf->queue, j);
+  m_async_queue_push_conservative(conf->queue, j);
   return;
 }
 
@@ -879,7 +910,7 @@ void create_job_to_dump_post(struct database *database, struct configuration *co
   sp->filename = build_schema_filename(sp->database->filename,"schema-post");
   if ( routine_checksums )
     sp->checksum_filename = build_meta_filename(sp->database->filename, NULL, "schema-post-checksum");
-  g_async_queue_push(conf->queue, j);
+  m_async_queue_push_conservative(conf->queue, j);
   return;
 }
 
@@ -892,7 +923,7 @@ void create_job_to_dump_checksum(struct db_table * dbt, struct configuration *co
   j->conf = conf;
   j->type = JOB_CHECKSUM;
   tcj->filename = build_meta_filename(dbt->database->filename, dbt->table_filename,"checksum");
-  g_async_queue_push(conf->queue, j);
+  m_async_queue_push_conservative(conf->queue, j);
   return;
 }
 
@@ -910,56 +941,74 @@ void create_job_to_dump_database(struct database *database, struct configuration
   if (less_locking)
     g_async_queue_push(conf->queue_less_locking, j);
   else
-    g_async_queue_push(conf->queue, j);
+    m_async_queue_push_conservative(conf->queue, j);
   return;
 }
 
-void m_async_queue_push_conservative(GAsyncQueue *queue, struct job *element){
-  // Each job weights 500 bytes aprox.
-  // if we reach to 200k of jobs, which is 100MB of RAM, we are going to wait 5 seconds
-  // which is not too much considering that it will impossible to proccess 200k of jobs
-  // in 5 seconds.
-  // I don't think that we need to this values as parameters, unless that a user needs to
-  // set hundreds of threads
-  while (g_async_queue_length(queue)>200000){
-    g_warning("Too many jobs in the queue. We are pausing the jobs creation for 5 seconds.");
-    sleep(5);
-  }
-  g_async_queue_push(queue, element);
+/* The threads that pop from conf->queue can create jobs too, while dumping
+ * a database. They only wait for room in the queue while another consumer
+ * is still popping, otherwise nobody would drain it. */
+void register_job_queue_consumer(){
+  g_private_set(job_queue_consumer_key, GINT_TO_POINTER(1));
+  g_atomic_int_inc(&job_queue_consumers);
 }
 
-GList * get_partitions_for_table(MYSQL *conn, char *database, char *table){
-  MYSQL_RES *res=NULL;
-  MYSQL_ROW row;
-
-  GList *partition_list = NULL;
+void unregister_job_queue_consumer(){
+  g_private_set(job_queue_consumer_key, NULL);
+  g_atomic_int_add(&job_queue_consumers, -1);
+}
 
-  gchar *query = g_strdup_printf("select PARTITION_NAME from information_schema.PARTITIONS where PARTITION_NAME is not null and TABLE_SCHEMA='%s' and TABLE_NAME='%s'", database, table);
-  mysql_query(conn,query);
-  g_free(query);
+gint get_job_queue_waiting_producers(){
+  return g_atomic_int_get(&job_queue_waiting_producers);
+}
 
-  res = mysql_store_result(conn);
-  if (res == NULL)
-    //partitioning is not supported
-    return partition_list;
-  while ((row = mysql_fetch_row(res))) {
-    partition_list = g_list_append(partition_list, strdup(row[0]));
+/* Wakes up the producers once the queue is drained to half of
+ * --max-queued-jobs */
+void notify_job_queue_consumed(GAsyncQueue *queue){
+  if (g_atomic_int_get(&job_queue_waiting_producers) &&
+      g_async_queue_length(queue) <= (gint)max_queued_jobs / 2) {
+    g_mutex_lock(job_queue_mutex);
+    g_cond_broadcast(job_queue_cond);
+    g_mutex_unlock(job_queue_mutex);
   }
-  mysql_free_result(res);
+}
 
-  return partition_list;
+gboolean can_wait_for_job_queue(gboolean consumer){
+  return g_atomic_int_get(&job_queue_consumers) - job_queue_waiting_consumers -
+             (consumer ? 1 : 0) > 0;
+}
+
+void m_async_queue_push_conservative(GAsyncQueue *queue, struct job *element){
+  gboolean consumer;
+  if (g_async_queue_length(queue) >= (gint)max_queued_jobs) {
+    consumer = g_private_get(job_queue_consumer_key) != NULL;
+    g_mutex_lock(job_queue_mutex);
+    g_atomic_int_inc(&job_queue_waiting_producers);
+    while (g_async_queue_length(queue) > (gint)max_queued_jobs / 2 &&
+           can_wait_for_job_queue(consumer)) {
+      if (consumer)
+        job_queue_waiting_consumers++;
+      g_cond_wait(job_queue_cond, job_queue_mutex);
+      if (consumer)
+        job_queue_waiting_consumers--;
+    }
+    g_atomic_int_add(&job_queue_waiting_producers, -1);
+    g_mutex_unlock(job_queue_mutex);
+  }
+  g_async_queue_push(queue, element);
 }
 
 /* Try to get EXPLAIN'ed estimates of row in resultset */
-guint64 estimate_count(MYSQL *conn, char *database, char *table, char *field,
-                       char *from, char *to) {
+guint64 estimate_count(MYSQL *conn, char *database, char *table,
+                       char *partition, char *field, char *from, char *to) {
   char *querybase, *query;
   int ret;
 
   g_assert(conn && database && table);
 
-  querybase = g_strdup_printf("EXPLAIN SELECT `%s` FROM `%s`.`%s`",
-                              (field ? field : "*"), database, table);
+  querybase = g_strdup_printf("EXPLAIN SELECT `%s` FROM `%s`.`%s` %s",
+                              (field ? field : "*"), database, table,
+                              partition ? partition : "");
   if (from || to) {
     g_assert(field != NULL);
     char *fromclause = NULL, *toclause = NULL;
@@ -1022,139 +1071,6 @@ guint64 estimate_count(MYSQL *conn, char *database, char *table, char *field,
   return (count);
 }
 
-GList *get_chunks_for_table(MYSQL *conn, char *database, char *table,
-                            struct configuration *conf) {
-
-  GList *chunks = NULL;
-  MYSQL_RES *indexes = NULL, *minmax = NULL, *total = NULL;
-  MYSQL_ROW row;
-  char *field = NULL;
-  int showed_nulls = 0;
-
-  /* first have to pick index, in future should be able to preset in
-   * configuration too */
-  gchar *query = g_strdup_printf("SHOW INDEX FROM `%s`.`%s`", database, table);
-  mysql_query(conn, query);
-  g_free(query);
-  indexes = mysql_store_result(conn);
-
-  if (indexes){
-    while ((row = mysql_fetch_row(indexes))) {
-      if (!strcmp(row[2], "PRIMARY") && (!strcmp(row[3], "1"))) {
-        /* Pick first column in PK, cardinality doesn't matter */
-        field = row[4];
-        break;
-      }
-    }
-
-    /* If no PK found, try using first UNIQUE index */
-    if (!field) {
-      mysql_data_seek(indexes, 0);
-      while ((row = mysql_fetch_row(indexes))) {
-        if (!strcmp(row[1], "0") && (!strcmp(row[3], "1"))) {
-          /* Again, first column of any unique index */
-          field = row[4];
-          break;
-        }
-      }
-    }
-    /* Still unlucky? Pick any high-cardinality index */
-    if (!field && conf->use_any_index) {
-      guint64 max_cardinality = 0;
-      guint64 cardinality = 0;
-
-      mysql_data_seek(indexes, 0);
-      while ((row = mysql_fetch_row(indexes))) {
-        if (!strcmp(row[3], "1")) {
-          if (row[6])
-            cardinality = strtoul(row[6], NULL, 10);
-          if (cardinality > max_cardinality) {
-            field = row[4];
-            max_cardinality = cardinality;
-          }
-        }
-      }
-    }
-  }
-  /* Oh well, no chunks today - no suitable index */
-  if (!field)
-    goto cleanup;
-
-  /* Get minimum/maximum */
-  mysql_query(conn, query = g_strdup_printf(
-                        "SELECT %s MIN(`%s`),MAX(`%s`) FROM `%s`.`%s` %s %s",
-                        (detected_server == SERVER_TYPE_MYSQL)
-                            ? "/*!40001 SQL_NO_CACHE */"
-                            : "",
-                        field, field, database, table, where_option ? "WHERE" : "", where_option ? where_option : ""));
-  g_free(query);
-  minmax = mysql_store_result(conn);
-
-  if (!minmax)
-    goto cleanup;
-
-  row = mysql_fetch_row(minmax);
-  MYSQL_FIELD *fields = mysql_fetch_fields(minmax);
-
-  /* Check if all values are NULL */
-  if (row[0] == NULL)
-    goto cleanup;
-
-  char *min = row[0];
-  char *max = row[1];
-
-  guint64 estimated_chunks, estimated_step, nmin, nmax, cutoff, rows;
-
-  /* Support just bigger INTs for now, very dumb, no verify approach */
-  switch (fields[0].type) {
-  case MYSQL_TYPE_LONG:
-  case MYSQL_TYPE_LONGLONG:
-  case MYSQL_TYPE_INT24:
-  case MYSQL_TYPE_SHORT:
-    /* Got total number of rows, skip chunk logic if estimates are low */
-    rows = estimate_count(conn, database, table, field, min, max);
-    if (rows <= rows_per_file)
-      goto cleanup;
-
-    /* This is estimate, not to use as guarantee! Every chunk would have eventual
-     * adjustments */
-    estimated_chunks = rows / rows_per_file;
-    /* static stepping */
-    nmin = strtoul(min, NULL, 10);
-    nmax = strtoul(max, NULL, 10);
-    estimated_step = (nmax - nmin) / estimated_chunks + 1;
-    if (estimated_step > max_rows)
-      estimated_step = max_rows;
-    cutoff = nmin;
-    while (cutoff <= nmax) {
-      chunks = g_list_prepend(
-          chunks,
-          g_strdup_printf("%s%s%s%s(`%s` >= %llu AND `%s` < %llu)",
-                          !showed_nulls ? "`" : "",
-                          !showed_nulls ? field : "",
-                          !showed_nulls ? "`" : "",
-                          !showed_nulls ? " IS NULL OR " : "", field,
-                          (unsigned long long)cutoff, field,
-                          (unsigned long long)(cutoff + estimated_step)));
-      cutoff += estimated_step;
-      showed_nulls = 1;
-    }
-    chunks = g_list_reverse(chunks);
-// TODO: We need to add more chunk options for different types
-  default:
-    goto cleanup;
-  }
-
-cleanup:
-  if (indexes)
-    mysql_free_result(indexes);
-  if (minmax)
-    mysql_free_result(minmax);
-  if (total)
-    mysql_free_result(total);
-  return chunks;
-}
-
 
 struct table_job * new_table_job(struct db_table *dbt, char *partition, char *where, guint nchunk, char *order_by){
   struct table_job *tj = g_new0(struct table_job, 1);
@@ -1172,113 +1088,123 @@ struct table_job * new_table_job(struct db_table *dbt, char *partition, char *wh
   return tj;
 }
 
-gchar *get_primary_key_string(MYSQL *conn, char *database, char *table) {
-  if (!order_by_primary_key) return NULL;
-
-  MYSQL_RES *res = NULL;
-  MYSQL_ROW row;
-
-  GString *field_list = g_string_new("");
-
-  gchar *query =
-          g_strdup_printf("SELECT k.COLUMN_NAME, ORDINAL_POSITION "
-                          "FROM information_schema.table_constraints t "
-                          "LEFT JOIN information_schema.key_column_usage k "
-                          "USING(constraint_name,table_schema,table_name) "
-                          "WHERE t.constraint_type IN ('PRIMARY KEY', 'UNIQUE') "
-                          "AND t.table_schema='%s' "
-                          "AND t.table_name='%s' "
-                          "ORDER BY t.constraint_type, ORDINAL_POSITION; ",
-                          database, table);
-  mysql_query(conn, query);
-  g_free(query);
+gchar *get_primary_key_string(struct db_table *dbt) {
+  if (!order_by_primary_key || !dbt->catalog->primary_key) return NULL;
+  return g_strdup(dbt->catalog->primary_key);
+}
 
-  res = mysql_store_result(conn);
-  gboolean first = TRUE;
-  while ((row = mysql_fetch_row(res))) {
-    if (first) {
-      first = FALSE;
-    } else if (atoi(row[1]) > 1) {
-      g_string_append(field_list, ",");
-    } else {
-      break;
+/* Returns the jobs to dump a table, or one of its partitions, split in chunks
+ * when --rows or --chunk-target-bytes are used. The chunks of a partition
+ * keep the part number of the partition and use the sub part. */
+GList *get_table_jobs(MYSQL *conn, struct db_table *dbt, char *partition,
+                      guint npartition, gchar *order_by, gboolean cached,
+                      struct configuration *conf) {
+  GList *table_jobs = NULL;
+  GList *chunks = NULL;
+  GList *iter;
+  struct table_job *tj = NULL;
+  struct table_job_shared *shared = NULL;
+  struct keyset_iterator *keyset = NULL;
+  guint nchunk = 0;
+
+  if (rows_per_file || chunk_target_bytes) {
+    if (cached)
+      chunks = get_cached_chunks_for_table(dbt, partition);
+    else
+      chunks = get_chunks_for_table(conn, dbt, partition, conf);
+    cache_chunks_for_table(dbt, partition, chunks);
+  }
+  /* The jobs of sampled chunks are given the same iterator, and the ones of
+   * a partition the same sub part counter */
+  if (chunks && dbt->chunk_type == SAMPLED)
+    keyset = (struct keyset_iterator *)chunks->data;
+  if (partition || keyset)
+    shared = new_table_job_shared(keyset, partition ? g_new0(gint, 1) : NULL);
+
+  if (!chunks) {
+    tj = new_table_job(dbt, partition ? g_strdup(partition) : NULL, NULL, npartition, order_by ? g_strdup(order_by) : NULL);
+    if (shared) {
+      share_table_job(tj, shared);
+      tj->sub_part = g_atomic_int_add(tj->sub_part_counter, 1);
     }
-
-    gchar *tb = g_strdup_printf("`%s`", row[0]);
-    g_string_append(field_list, tb);
-    g_free(tb);
+    return g_list_append(table_jobs, tj);
   }
-  mysql_free_result(res);
-  // Return NULL if we never found a PRIMARY or UNIQUE key
-  if (first) {
-    g_string_free(field_list, TRUE);
-    return NULL;
-  } else {
-    return g_string_free(field_list, FALSE);
+
+  for (iter = chunks; iter != NULL; iter = iter->next) {
+    tj = new_table_job(dbt, partition ? g_strdup(partition) : NULL, dbt->chunk_type == HASH ? (char *)iter->data : NULL, partition ? npartition : nchunk, order_by ? g_strdup(order_by) : NULL);
+    if (shared)
+      share_table_job(tj, shared);
+    if (dbt->chunk_type == INTEGER)
+      tj->chunk_step = (struct integer_step *)iter->data;
+    else if (dbt->chunk_type != SAMPLED && tj->sub_part_counter)
+      tj->sub_part = g_atomic_int_add(tj->sub_part_counter, 1);
+    table_jobs = g_list_prepend(table_jobs, tj);
+    nchunk++;
   }
+  g_list_free(chunks);
+  return g_list_reverse(table_jobs);
 }
 
-void create_job_to_dump_table(MYSQL *conn, struct db_table *dbt,
-                struct configuration *conf, gboolean is_innodb) {
-//  char *database = dbt->database;
-//  char *table = dbt->table;
-  GList * partitions = NULL;
-  if (split_partitions)
-    partitions = get_partitions_for_table(conn, dbt->database->name, dbt->table);
+GList *get_table_jobs_for_table(MYSQL *conn, struct db_table *dbt,
+                                struct configuration *conf) {
+  GList *table_jobs = NULL;
+  GList *partitions = NULL;
+  GList *iter;
+  guint npartition = 0;
+  gboolean cached = FALSE;
+  gchar *order_by = get_primary_key_string(dbt);
 
-  GList *chunks = NULL;
-  if (rows_per_file)
-    chunks = get_chunks_for_table(conn, dbt->database->name, dbt->table, conf);
-
-  if (partitions){
-    int npartition=0;
-    for (partitions = g_list_first(partitions); partitions; partitions=g_list_next(partitions)) {
-      struct job *j = g_new0(struct job,1);
-      struct table_job *tj = NULL;
-      j->job_data=(void*) tj;
-      j->conf=conf;
-      j->type= is_innodb ? JOB_DUMP : JOB_DUMP_NON_INNODB;
-      tj = new_table_job(dbt, (char *) g_strdup_printf(" PARTITION (%s) ", (char *)partitions->data), NULL, npartition, get_primary_key_string(conn, dbt->database->name, dbt->table));
-      j->job_data = (void *)tj;
-      if (!is_innodb && npartition)
-        g_atomic_int_inc(&non_innodb_table_counter);
-      g_async_queue_push(conf->queue,j);
+  if (split_partitions)
+    partitions = dbt->catalog->partitions;
+  if (rows_per_file || chunk_target_bytes)
+    cached = use_cached_chunk_plan(dbt, partitions);
+
+  if (partitions) {
+    /* We only know the average row length of the whole table, so the rows
+     * per chunk are the same for all the partitions */
+    if ((rows_per_file || chunk_target_bytes) && !cached)
+      dbt->chunk_rows = get_rows_per_chunk(dbt, estimate_count(conn, dbt->database->name, dbt->table, NULL, NULL, NULL, NULL));
+    for (iter = partitions; iter != NULL; iter = iter->next) {
+      gchar *partition = g_strdup_printf(" PARTITION (%s) ", (char *)iter->data);
+      table_jobs = g_list_concat(table_jobs, get_table_jobs(conn, dbt, partition, npartition, order_by, cached, conf));
+      g_free(partition);
       npartition++;
     }
-    g_list_free_full(g_list_first(partitions), (GDestroyNotify)g_free);
-
-  } else if (chunks) {
-    int nchunk = 0;
-    GList *iter;
-    for (iter = chunks; iter != NULL; iter = iter->next) {
-      struct job *j = g_new0(struct job, 1);
-      struct table_job *tj = NULL;
-      j->conf = conf;
-      j->type = is_innodb ? JOB_DUMP : JOB_DUMP_NON_INNODB;
-      tj = new_table_job(dbt, NULL, (char *)iter->data, nchunk, get_primary_key_string(conn, dbt->database->name, dbt->table));
-      j->job_data = (void *)tj;
-      if (!is_innodb && nchunk)
-        g_atomic_int_inc(&non_innodb_table_counter);
-      m_async_queue_push_conservative(conf->queue, j);
-      nchunk++;
-    }
-    g_list_free(chunks);
   } else {
+    table_jobs = get_table_jobs(conn, dbt, NULL, 0, order_by, cached, conf);
+  }
+  g_free(order_by);
+  return table_jobs;
+}
+
+void create_job_to_dump_table(MYSQL *conn, struct db_table *dbt,
+                struct configuration *conf, gboolean is_innodb) {
+  GList *table_jobs = get_table_jobs_for_table(conn, dbt, conf);
+  GList *iter;
+  /* The jobs of a table are expected to take the same time */
+  guint64 size = dbt->datalength / g_list_length(table_jobs);
+  for (iter = table_jobs; iter != NULL; iter = iter->next) {
     struct job *j = g_new0(struct job, 1);
-    struct table_job *tj = NULL;
+    struct table_job *tj = (struct table_job *)iter->data;
     j->conf = conf;
     j->type = is_innodb ? JOB_DUMP : JOB_DUMP_NON_INNODB;
-    tj = new_table_job(dbt, NULL, NULL, 0, get_primary_key_string(conn, dbt->database->name, dbt->table));
     j->job_data = (void *)tj;
-    g_async_queue_push(conf->queue, j);
+    if (is_innodb && tj->chunk_step)
+      register_stealable_table_job(tj);
+    if (is_innodb) {
+      schedule_table_job(tj, size);
+      j->job_data = NULL;
+    }
+    if (!is_innodb && iter != table_jobs)
+      g_atomic_int_inc(&non_innodb_table_counter);
+    m_async_queue_push_conservative(conf->queue, j);
   }
+  g_list_free(table_jobs);
 }
 
 void create_jobs_for_non_innodb_table_list_in_less_locking_mode(MYSQL *conn, GList *noninnodb_tables_list,
                  struct configuration *conf) {
   struct db_table *dbt=NULL;
-  GList *chunks = NULL;
-  GList * partitions = NULL;
 
   struct job *j = g_new0(struct job, 1);
   struct tables_job *tjs = g_new0(struct tables_job, 1);
@@ -1290,38 +1216,7 @@ void create_jobs_for_non_innodb_table_list_in_less_locking_mode(MYSQL *conn, GLi
 
   for (iter = noninnodb_tables_list; iter != NULL; iter = iter->next) {
     dbt = (struct db_table *)iter->data;
-
-    if (rows_per_file)
-      chunks = get_chunks_for_table(conn, dbt->database->name, dbt->table, conf);
-
-    if (split_partitions)
-      partitions = get_partitions_for_table(conn, dbt->database->name, dbt->table);
-
-    if (partitions){
-      int npartition=0;
-      for (partitions = g_list_first(partitions); partitions; partitions=g_list_next(partitions)) {
-        struct table_job *tj = NULL;
-        tj = new_table_job(dbt, (char *) g_strdup_printf(" PARTITION (%s) ", (char *)partitions->data), NULL, npartition, get_primary_key_string(conn, dbt->database->name, dbt->table));
-        tjs->table_job_list = g_list_prepend(tjs->table_job_list, tj);
-        npartition++;
-      }
-      g_list_free_full(g_list_first(partitions), (GDestroyNotify)g_free);
-
-    } else if (chunks) {
-      int nchunk = 0;
-      GList *citer;
-      for (citer = chunks; citer != NULL; citer = citer->next) {
-        struct table_job *tj = new_table_job(dbt, NULL, (char *)citer->data, nchunk, get_primary_key_string(conn, dbt->database->name, dbt->table));
-        tjs->table_job_list = g_list_prepend(tjs->table_job_list, tj);
-        nchunk++;
-      }
-      g_list_free(chunks);
-    } else {
-      struct table_job *tj = NULL;
-      tj = new_table_job(dbt, NULL, NULL, 0, get_primary_key_string(conn, dbt->database->name, dbt->table));
-      tjs->table_job_list = g_list_prepend(tjs->table_job_list, tj);
-    }
+    tjs->table_job_list = g_list_concat(tjs->table_job_list, get_table_jobs_for_table(conn, dbt, conf));
   }
-  tjs->table_job_list = g_list_reverse(tjs->table_job_list);
   g_async_queue_push(conf->queue_less_locking, j);
 }
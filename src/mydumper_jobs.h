@@ -59,6 +59,11 @@ struct table_checksum_job {
 };
 
 void initialize_dump_into_file();
+void register_job_queue_consumer();
+void unregister_job_queue_consumer();
+void notify_job_queue_consumed(GAsyncQueue *queue);
+gint get_job_queue_waiting_producers();
+void m_async_queue_push_conservative(GAsyncQueue *queue, struct job *element);
 void load_dump_into_file_entries(GOptionGroup *main_group);
 void create_job_to_dump_tablespaces(MYSQL *conn, struct configuration *conf);
 void create_job_to_dump_post(struct database *database, struct configuration *conf);
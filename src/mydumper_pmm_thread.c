@@ -24,9 +24,11 @@
 #include <gio/gio.h>
 #include <mysql.h>
 #include "mydumper_start_dump.h"
+#include "mydumper_jobs.h"
 extern gchar *pmm_resolution ;
 extern gchar *pmm_path;
 extern GAsyncQueue *stream_queue;
+extern guint max_queued_jobs;
 
 gint kill_pmm = 0;
 
@@ -48,6 +50,8 @@ void write_pmm_entries(const gchar* filename, GString *content, struct configura
   append_pmm_entry(content,"unlock_tables",     conf->unlock_tables);
   append_pmm_entry(content,"pause_resume",      conf->pause_resume);
   append_pmm_entry(content,"stream_queue",      stream_queue);
+  g_string_append_printf(content,"mydumper_queue_capacity{name=\"queue\"} %u\n",max_queued_jobs);
+  g_string_append_printf(content,"mydumper_queue_waiting_producers{name=\"queue\"} %d\n",get_job_queue_waiting_producers());
   g_file_set_contents( filename , content->str, content->len, NULL);
 }
 
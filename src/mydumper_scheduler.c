@@ -0,0 +1,119 @@
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+        Authors:    David Ducos, Percona (david dot ducos at percona dot com)
+*/
+#include <mysql.h>
+#include <glib.h>
+#include <stdio.h>
+#include "mydumper_start_dump.h"
+#include "mydumper_scheduler.h"
+
+extern guint num_threads;
+extern guint max_threads_per_table;
+
+/* InnoDB table jobs are not dumped in the order they are found. The job
+ * pushed to conf->queue is only a token, the thread that pops it takes the
+ * biggest job pending, so the biggest tables don't start at the end of the
+ * dump. */
+struct scheduled_table_job {
+  struct table_job *tj;
+  guint64 size;
+  guint64 order;
+};
+
+GSequence *scheduled_table_jobs = NULL;
+GMutex *scheduler_mutex = NULL;
+GCond *scheduler_cond = NULL;
+guint64 scheduled_order = 0;
+
+void initialize_scheduler(){
+  scheduled_table_jobs = g_sequence_new(g_free);
+  scheduler_mutex = g_mutex_new();
+  scheduler_cond = g_cond_new();
+}
+
+/* Biggest first, and in the order they were found when they have the same
+ * size */
+gint compare_scheduled_table_jobs(gconstpointer a, gconstpointer b,
+                                  gpointer data) {
+  const struct scheduled_table_job *sa = a, *sb = b;
+  (void)data;
+  if (sa->size != sb->size)
+    return sa->size > sb->size ? -1 : 1;
+  return sa->order < sb->order ? -1 : (sa->order > sb->order);
+}
+
+void schedule_table_job(struct table_job *tj, guint64 size){
+  struct scheduled_table_job *stj = g_new(struct scheduled_table_job, 1);
+  stj->tj = tj;
+  stj->size = size;
+  g_mutex_lock(scheduler_mutex);
+  stj->order = scheduled_order++;
+  g_sequence_insert_sorted(scheduled_table_jobs, stj,
+                           compare_scheduled_table_jobs, NULL);
+  g_mutex_unlock(scheduler_mutex);
+}
+
+/* --max-threads-per-table limits the threads that dump the same table at
+ * the same time, including the ones that split its ranges */
+gboolean is_table_thread_available(struct db_table *dbt){
+  return !max_threads_per_table || max_threads_per_table >= num_threads ||
+         g_atomic_int_get(&dbt->current_threads) < (gint)max_threads_per_table;
+}
+
+gboolean acquire_table_thread(struct db_table *dbt){
+  gint current;
+  do {
+    current = g_atomic_int_get(&dbt->current_threads);
+    if (max_threads_per_table && max_threads_per_table < num_threads &&
+        current >= (gint)max_threads_per_table)
+      return FALSE;
+  } while (!g_atomic_int_compare_and_exchange(&dbt->current_threads, current,
+                                              current + 1));
+  return TRUE;
+}
+
+void release_table_thread(struct db_table *dbt){
+  g_atomic_int_add(&dbt->current_threads, -1);
+  g_mutex_lock(scheduler_mutex);
+  g_cond_broadcast(scheduler_cond);
+  g_mutex_unlock(scheduler_mutex);
+}
+
+/* Every token has its job, so this only waits when all the pending jobs
+ * belong to tables that already have --max-threads-per-table threads. The
+ * caller has to release the table thread when the job is done. */
+struct table_job *get_scheduled_table_job(){
+  GSequenceIter *iter;
+  struct scheduled_table_job *stj;
+  struct table_job *tj = NULL;
+
+  g_mutex_lock(scheduler_mutex);
+  while (!tj) {
+    for (iter = g_sequence_get_begin_iter(scheduled_table_jobs);
+         !g_sequence_iter_is_end(iter); iter = g_sequence_iter_next(iter)) {
+      stj = g_sequence_get(iter);
+      if (acquire_table_thread(stj->tj->dbt)) {
+        tj = stj->tj;
+        g_sequence_remove(iter);
+        break;
+      }
+    }
+    if (!tj)
+      g_cond_wait(scheduler_cond, scheduler_mutex);
+  }
+  g_mutex_unlock(scheduler_mutex);
+  return tj;
+}
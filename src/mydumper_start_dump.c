@@ -36,11 +36,7 @@
 #include <stdarg.h>
 #include <errno.h>
 #include <time.h>
-#ifdef ZWRAP_USE_ZSTD
-#include "../zstd/zstd_zlibwrapper.h"
-#else
 #include <zlib.h>
-#endif
 #include <pcre.h>
 #include <signal.h>
 #include <glib/gstdio.h>
@@ -66,10 +62,15 @@
 #include "mydumper_common.h"
 #include "mydumper_stream.h"
 #include "mydumper_database.h"
+#include "mydumper_catalog.h"
 #include "mydumper_working_thread.h"
 #include "mydumper_pmm_thread.h"
 #include "mydumper_exec_command.h"
 #include "mydumper_masquerade.h"
+#include "mydumper_chunks.h"
+#include "mydumper_writer.h"
+#include "mydumper_io.h"
+#include "compression.h"
 /* Some earlier versions of MySQL do not yet define MYSQL_TYPE_JSON */
 #ifndef MYSQL_TYPE_JSON
 #define MYSQL_TYPE_JSON 245
@@ -78,15 +79,18 @@
 /* Program options */
 extern GKeyFile * key_file;
 extern gint database_counter;
-extern GAsyncQueue *stream_queue;
 extern gchar *output_directory;
 extern gchar *output_directory_param;
 extern gchar *dump_directory;
+extern gchar **output_directories;
+extern guint num_output_directories;
 extern guint snapshot_count;
 extern gboolean daemon_mode;
 extern gchar *disk_limits;
 extern gboolean load_data;
 extern gboolean stream;
+extern gboolean stream_diskless;
+extern guint num_write_threads;
 extern int detected_server;
 extern gboolean no_delete;
 extern char *defaults_file;
@@ -107,6 +111,11 @@ int longquery_retry_interval = 60;
 int need_dummy_read = 0;
 int need_dummy_toku_read = 0;
 int compress_output = 0;
+extern enum compression_method compression_method;
+extern gint compress_level;
+extern gboolean compress_long;
+extern guint compress_workers;
+extern gboolean compress_dictionary;
 int killqueries = 0;
 int lock_all_tables = 0;
 gboolean no_schemas = FALSE;
@@ -144,12 +153,66 @@ extern GAsyncQueue *start_scheduled_dump;
 extern guint errors;
 
 gchar *exec_command=NULL;
+extern guint exec_threads;
+extern guint exec_retries;
+extern gboolean exec_stdin;
+extern gchar *io_backend;
+extern gboolean direct_io;
+extern struct output_backend *output_backend;
+extern struct output_backend stdio_output_backend;
+
+/* -c alone keeps the codec the build used to compress with */
+gboolean compress_callback(const gchar *option_name,const gchar *value, gpointer data, GError **error){
+  *error=NULL;
+  (void) option_name;
+  (void) data;
+  if (value==NULL){
+#ifdef WITH_ZSTD
+    compression_method = COMPRESSION_ZSTD;
+#else
+    compression_method = COMPRESSION_GZIP;
+#endif
+  }else if (!parse_compression_method(value, &compression_method)){
+    g_set_error(error, G_OPTION_ERROR, G_OPTION_ERROR_BAD_VALUE,
+                "Unknown compression method: %s", value);
+    return FALSE;
+  }else if (!is_compression_method_available(compression_method)){
+    g_set_error(error, G_OPTION_ERROR, G_OPTION_ERROR_BAD_VALUE,
+                "%s support is not built in", value);
+    return FALSE;
+  }
+  compress_output = compression_method != COMPRESSION_NONE;
+  return TRUE;
+}
 
 static GOptionEntry start_dump_entries[] = {
-    {"compress", 'c', 0, G_OPTION_ARG_NONE, &compress_output,
-     "Compress output files", NULL},
+    {"compress", 'c', G_OPTION_FLAG_OPTIONAL_ARG, G_OPTION_ARG_CALLBACK, &compress_callback,
+     "Compress output files using: gzip, zstd, lz4 or none, as --compress=METHOD. "
+     "-c alone uses zstd when it is built in and gzip otherwise", NULL},
+    {"compress-level", 0, 0, G_OPTION_ARG_INT, &compress_level,
+     "Compression level, default is the one of the method", NULL},
+    {"compress-long", 0, 0, G_OPTION_ARG_NONE, &compress_long,
+     "Use zstd long distance matching, for tables with repeated rows far apart",
+     NULL},
+    {"compress-workers", 0, 0, G_OPTION_ARG_INT, &compress_workers,
+     "Threads zstd uses to compress each file, default 0", NULL},
+    {"compress-dictionary", 0, 0, G_OPTION_ARG_NONE, &compress_dictionary,
+     "Train a zstd dictionary for each table from its first rows and "
+     "compress the rest of its files with it", NULL},
     {"exec", 0, 0, G_OPTION_ARG_STRING, &exec_command,
       "Command to execute using the file as parameter", NULL},
+    {"exec-threads", 0, 0, G_OPTION_ARG_INT, &exec_threads,
+      "Amount of commands of --exec running at the same time, default 4", NULL},
+    {"exec-retries", 0, 0, G_OPTION_ARG_INT, &exec_retries,
+      "Times --exec is retried on a file when it fails, default 0", NULL},
+    {"exec-stdin", 0, 0, G_OPTION_ARG_NONE, &exec_stdin,
+      "Send the files to the standard input of --exec, the data files are piped as they are made and never written to disk", NULL},
+    {"stream-diskless", 0, 0, G_OPTION_ARG_NONE, &stream_diskless,
+      "Stream the data files from memory, without writing them to disk. Implies --stream", NULL},
+    {"io-backend", 0, 0, G_OPTION_ARG_STRING, &io_backend,
+      "How the writer threads write the data files: stdio or io_uring, default stdio", NULL},
+    {"direct-io", 0, 0, G_OPTION_ARG_NONE, &direct_io,
+      "Write the data files with O_DIRECT, bypassing the page cache. Needs --io-backend=io_uring", NULL},
     {"long-query-retries", 0, 0, G_OPTION_ARG_INT, &longquery_retries,
      "Retry checking for long queries, default 0 (do not retry)", NULL},
     {"long-query-retry-interval", 0, 0, G_OPTION_ARG_INT, &longquery_retry_interval,
@@ -230,6 +293,32 @@ void initialize_start_dump(){
     pmm_path=g_strdup_printf("/usr/local/percona/pmm2/collectors/textfile-collector/%s-resolution",pmm_resolution);
   }
 
+  // The data files are compressed, and streamed, by the writer threads
+  if (stream_diskless){
+    stream=TRUE;
+    if (!num_write_threads)
+      num_write_threads=num_threads;
+  }
+
+  // The data files are piped to the commands by the writer threads
+  if (exec_stdin){
+    if (exec_command == NULL){
+      g_critical("--exec-stdin needs --exec");
+      exit(EXIT_FAILURE);
+    }
+    if (!num_write_threads)
+      num_write_threads=num_threads;
+  }
+
+  // io_uring writes the data files for the writer threads
+  initialize_output_backend();
+  if (output_backend != &stdio_output_backend){
+    if (!data_files_on_disk())
+      g_warning("--io-backend is not used, the data files are not written to disk");
+    else if (!num_write_threads)
+      num_write_threads=num_threads;
+  }
+
   if (stream && exec_command != NULL){
     g_critical("Stream and execute a command is not supported");
     exit(EXIT_FAILURE);
@@ -340,14 +429,18 @@ void set_disk_limits(guint p_at, guint r_at){
   resume_at=r_at;
 }
 
+/* The dump is paused when any of the --outputdir directories is low */
 gboolean is_disk_space_ok(guint val){
   struct statvfs buffer;
-  int ret = statvfs(output_directory, &buffer);
-  if (!ret) {
-    const double available = (double)(buffer.f_bfree * buffer.f_frsize) / 1024 / 1024;
-    return available > val;
-  }else{
-    g_warning("Disk space check failed");
+  guint i;
+  for (i = 0; i < num_output_directories; i++){
+    if (!statvfs(output_directories[i], &buffer)) {
+      const double available = (double)(buffer.f_bfree * buffer.f_frsize) / 1024 / 1024;
+      if (available <= val)
+        return FALSE;
+    }else{
+      g_warning("Disk space check failed on %s", output_directories[i]);
+    }
   }
   return TRUE;
 }
@@ -566,7 +659,7 @@ void get_table_info_to_process_from_list(MYSQL *conn, struct configuration *conf
       if (!eval_regex(database->name, row[0]))
         continue;
 
-      new_table_to_dump(conn, conf, is_view, database, row[0], row[6], row[ecol]);
+      new_table_to_dump(conn, conf, is_view, database, row[0], row[4], row[6], row[ecol]);
     }
   }
 
@@ -938,6 +1031,8 @@ void start_dump() {
     nitl[n] = NULL;
   }
 
+  load_chunk_plan();
+
   metadata_partial_filename = g_strdup_printf("%s/metadata.partial", dump_directory);
   metadata_filename = g_strndup(metadata_partial_filename, (unsigned)strlen(metadata_partial_filename) - 8);
 
@@ -1075,6 +1170,12 @@ void start_dump() {
   GDateTime *datetime = g_date_time_new_now_local();
   char *datetimestr=g_date_time_format(datetime,"\%Y-\%m-\%d \%H:\%M:\%S");
   fprintf(mdfile, "Started dump at: %s\n", datetimestr);
+  // myloader finds the data files in them
+  if (num_output_directories > 1) {
+    fprintf(mdfile, "Output directories:\n");
+    for (n = 0; n < num_output_directories; n++)
+      fprintf(mdfile, "\t%s\n", output_directories[n]);
+  }
   g_message("Started dump at: %s", datetimestr);
   g_free(datetimestr);
 
@@ -1095,6 +1196,8 @@ void start_dump() {
   
   }
 
+  start_writer_threads();
+
   GThread **threads = g_new(GThread *, num_threads * (less_locking + 1));
   struct thread_data *td =
       g_new(struct thread_data, num_threads * (less_locking + 1));
@@ -1275,6 +1378,9 @@ void start_dump() {
   for (n = 0; n < num_threads; n++) {
     g_thread_join(threads[n]);
   }
+  stop_writer_threads();
+  save_chunk_plan();
+  clear_catalog();
 
   if (release_ddl_lock_function != NULL) {
     g_message("Releasing DDL lock");
@@ -1309,7 +1415,7 @@ void start_dump() {
     fclose(nufile);
   g_rename(metadata_partial_filename, metadata_filename);
   if (stream) {
-    g_async_queue_push(stream_queue, g_strdup(metadata_filename));
+    stream_queue_push(metadata_filename);
   }
   g_free(metadata_partial_filename);
   g_free(metadata_filename);
@@ -1317,7 +1423,7 @@ void start_dump() {
   g_free(datetimestr);
 
   if (stream) {
-    g_async_queue_push(stream_queue, g_strdup(""));
+    stream_queue_push("");
     if (exec_command!=NULL){
       wait_exec_command_to_finish();
     }else
@@ -33,6 +33,13 @@ enum job_type {
   JOB_DUMP_DATABASE
 };
 
+enum chunk_type {
+  NONE,
+  INTEGER,
+  SAMPLED,
+  HASH
+};
+
 struct configuration {
   char use_any_index;
   GAsyncQueue *queue;
@@ -53,6 +60,10 @@ struct thread_data {
   GAsyncQueue *queue;
   GAsyncQueue *ready;
   gboolean less_locking_stage;
+  // Rows are serialized in place here, reused by every job of the thread
+  GString *statement;
+  // Free buffers to swap the full one with, see mydumper_writer.c
+  GAsyncQueue *buffers;
 };
 
 struct job {
@@ -73,6 +84,11 @@ struct table_job {
   char *where;
   char *order_by;
   struct db_table *dbt;
+  struct integer_step *chunk_step;
+  struct keyset_iterator *keyset;
+  struct table_job_shared *shared;
+  guint sub_part;
+  gint *sub_part_counter;
 };
 
 struct tables_job {
@@ -103,9 +119,17 @@ struct db_table {
   GString *select_fields;
   gboolean has_generated_fields;
   guint64 datalength;
+  guint64 estimated_rows;
   guint rows;
   GMutex *rows_lock;
   GList *anonymized_function;
+  struct column_plan *column_plan;
+  struct table_dictionary *dictionary;
+  struct table_catalog *catalog;
+  enum chunk_type chunk_type;
+  guint chunk_part;
+  guint64 chunk_rows;
+  gint current_threads;
 };
 
 struct schema_post {
@@ -120,6 +144,7 @@ void *exec_thread(void *data);
 gboolean sig_triggered_int(void * user_data);
 gboolean sig_triggered_term(void * user_data);
 void set_disk_limits(guint p_at, guint r_at);
+gboolean write_buffer(FILE *, const gchar *, gsize);
 gboolean write_data(FILE *, GString *);
 
 
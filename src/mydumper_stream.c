@@ -17,116 +17,212 @@
 #include "string.h"
 #include <mysql.h>
 #include <glib/gstdio.h>
-#ifdef ZWRAP_USE_ZSTD
-#include "../zstd/zstd_zlibwrapper.h"
-#else
-#include <zlib.h>
-#endif
 #include <stdlib.h>
 #include <glib.h>
 #include <stdio.h>
 #include "common.h"
+#include "stream_format.h"
+#include "mydumper_common.h"
+#include "mydumper_stream.h"
+
+/* Bytes the workers can have waiting for stdout */
+#define STREAM_MEMORY_LIMIT (64 * STREAM_BUFFER_SIZE)
 
-extern FILE * (*m_open)(const char *filename, const char *);
-extern gchar *compress_extension;
-extern GAsyncQueue *stream_queue;
 extern gboolean no_delete;
 
 GThread *stream_thread = NULL;
+gboolean stream_diskless = FALSE;
+
+/* A piece of a file for the multiplexer, or the end of the file when data is
+ * NULL. The name is the one the file gets in the backup. */
+struct stream_block {
+  gchar *name;
+  GString *data;
+  guint32 checksum;
+};
+
+GThread *stream_multiplexer_thread = NULL;
+GAsyncQueue *stream_block_queue = NULL;
+GMutex *stream_memory_mutex = NULL;
+GCond *stream_memory_cond = NULL;
+gsize stream_memory = 0;
+
+/* The data files are not written in --stream-diskless, the writers hand
+ * their blocks over here, and wait while too many are pending. The checksum
+ * is computed by the caller, so it is done in parallel. */
+void stream_block(const gchar *name, GString *data) {
+  struct stream_block *sb = g_new(struct stream_block, 1);
+  sb->name = g_strdup(name);
+  sb->data = data;
+  sb->checksum = 0;
+  if (data) {
+    if (data->len > G_MAXUINT32) {
+      g_critical("Block of %s is too large to be streamed", name);
+      exit(EXIT_FAILURE);
+    }
+    sb->checksum = crc32c(0, data->str, data->len);
+    g_mutex_lock(stream_memory_mutex);
+    while (stream_memory && stream_memory + data->len > STREAM_MEMORY_LIMIT)
+      g_cond_wait(stream_memory_cond, stream_memory_mutex);
+    stream_memory += data->len;
+    g_mutex_unlock(stream_memory_mutex);
+  }
+  g_async_queue_push(stream_block_queue, sb);
+}
+
+void stream_end_of_file(const gchar *name) {
+  stream_block(name, NULL);
+}
+
+gboolean write_stdout(const void *data, gsize len) {
+  gsize written = 0;
+  ssize_t r;
+  while (written < len) {
+    r = write(fileno(stdout), (const gchar *)data + written, len - written);
+    if (r <= 0)
+      return FALSE;
+    written += r;
+  }
+  return TRUE;
+}
+
+gboolean write_stream_block(enum stream_block_type type, guint32 file_id,
+                            const gchar *data, guint32 len,
+                            guint32 checksum) {
+  guchar header[STREAM_BLOCK_HEADER_SIZE];
+  struct stream_block_header h = {type, file_id, len, checksum};
+  encode_stream_block_header(header, &h);
+  return write_stdout(header, STREAM_BLOCK_HEADER_SIZE) &&
+         (!len || write_stdout(data, len));
+}
+
+/* Blocks of different files go out interleaved. The first block of a file
+ * gives its name to the id its other blocks carry. */
+void *process_stream_blocks(void *data) {
+  GHashTable *file_ids =
+      g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+  guchar header[STREAM_HEADER_SIZE];
+  struct stream_block *sb;
+  guint32 file_id, last_file_id = 0;
+  gsize len;
+  guint64 total_size = 0;
+  GDateTime *start_time = g_date_time_new_now_local();
+  GTimeSpan diff = 0;
+  (void)data;
+  encode_stream_header(header);
+  if (!write_stdout(header, STREAM_HEADER_SIZE)) {
+    g_critical("Stream failed to start");
+    exit(EXIT_FAILURE);
+  }
+  for (;;) {
+    sb = g_async_queue_pop(stream_block_queue);
+    if (!sb->name) {
+      g_free(sb);
+      break;
+    }
+    file_id = GPOINTER_TO_UINT(g_hash_table_lookup(file_ids, sb->name));
+    if (!file_id) {
+      file_id = ++last_file_id;
+      g_hash_table_insert(file_ids, g_strdup(sb->name),
+                          GUINT_TO_POINTER(file_id));
+      len = strlen(sb->name);
+      if (!write_stream_block(STREAM_FILE_OPEN, file_id, sb->name, len,
+                              crc32c(0, sb->name, len))) {
+        g_critical("Stream failed during transmition of file: %s", sb->name);
+        exit(EXIT_FAILURE);
+      }
+    }
+    if (sb->data) {
+      len = sb->data->len;
+      if (!write_stream_block(STREAM_FILE_DATA, file_id, sb->data->str, len,
+                              sb->checksum)) {
+        g_critical("Stream failed during transmition of file: %s", sb->name);
+        exit(EXIT_FAILURE);
+      }
+      total_size += len;
+      g_mutex_lock(stream_memory_mutex);
+      stream_memory -= len;
+      g_cond_broadcast(stream_memory_cond);
+      g_mutex_unlock(stream_memory_mutex);
+      g_string_free(sb->data, TRUE);
+    } else {
+      if (!write_stream_block(STREAM_FILE_CLOSE, file_id, NULL, 0, 0)) {
+        g_critical("Stream failed during transmition of file: %s", sb->name);
+        exit(EXIT_FAILURE);
+      }
+      g_hash_table_remove(file_ids, sb->name);
+    }
+    g_free(sb->name);
+    g_free(sb);
+  }
+  if (!write_stream_block(STREAM_END, 0, NULL, 0, 0)) {
+    g_critical("Stream failed to end");
+    exit(EXIT_FAILURE);
+  }
+  g_hash_table_destroy(file_ids);
+  diff = g_date_time_difference(g_date_time_new_now_local(), start_time) /
+         G_TIME_SPAN_SECOND;
+  g_date_time_unref(start_time);
+  g_message("All data transfered was %" G_GUINT64_FORMAT
+            " at a rate of %" G_GUINT64_FORMAT " MB/s",
+            total_size, total_size / 1024 / 1024 / (diff ? diff : 1));
+  return NULL;
+}
+
+/* The files written to disk, like the schemas, go through the multiplexer
+ * too, so they do not get in the middle of a block */
+void stream_file_blocks(const gchar *filename) {
+  gchar *name = g_path_get_basename(filename);
+  FILE *f = g_fopen(filename, "r");
+  GString *block;
+  if (!f) {
+    g_critical("File failed to open: %s", filename);
+    exit(EXIT_FAILURE);
+  }
+  for (;;) {
+    block = g_string_sized_new(STREAM_BUFFER_SIZE);
+    g_string_set_size(block, fread(block->str, 1, STREAM_BUFFER_SIZE, f));
+    if (!block->len) {
+      g_string_free(block, TRUE);
+      break;
+    }
+    stream_block(name, block);
+  }
+  fclose(f);
+  stream_end_of_file(name);
+  g_free(name);
+}
 
 void *process_stream(void *data){
   (void)data;
   char * filename=NULL;
-  FILE * f=NULL;
-  char buf[STREAM_BUFFER_SIZE];
-  int buflen;
-  guint64 total_size=0;
-  GDateTime *total_start_time=g_date_time_new_now_local();
-  GTimeSpan diff=0,total_diff=0;
-//  gboolean not_compressed = FALSE;
-//  guint sz=0;
-  ssize_t len=0;
   for(;;){
-    filename=(char *)g_async_queue_pop(stream_queue);
+    filename=stream_queue_pop();
     if (strlen(filename) == 0){
+      g_free(filename);
       break;
     }
-    char *used_filemame=g_path_get_basename(filename);
-    len=write(fileno(stdout), "\n-- ", 4);
-    len=write(fileno(stdout), used_filemame, strlen(used_filemame));
-    len=write(fileno(stdout), "\n", 1);
-    total_size+=5;
-    total_size+=strlen(used_filemame);
-    free(used_filemame);
-    g_message("Opening: %s",filename);
-//    f=m_open(filename,"r");
-//    not_compressed= g_str_has_suffix(filename, compress_extension);
-//    if (not_compressed)
-      f=g_fopen(filename,"r");
-//    else
- //     f=m_open(filename,"r");
-    if (!f){
-      g_error("File failed to open: %s",filename);
-    }else{
-//      if (not_compressed){
-//        fseek(f, 0, SEEK_END);
-//        sz = ftell(f);
-//fseek(f, 0, SEEK_SET);
-//        m_close(f);
-//        f=g_fopen(filename,"r");
-//      }
-if (!f){
-      g_critical("File failed to open: %s. Reetrying",filename);
-      f=g_fopen(filename,"r");
-if (!f){
-g_error("File failed to open: %s. Cancelling",filename);
-exit(EXIT_FAILURE);
-}
-}
-      guint total_len=0;
-      GDateTime *start_time=g_date_time_new_now_local();
-//      buflen = not_compressed ? read(fileno(f), buf, STREAM_BUFFER_SIZE): gzread((gzFile)f, buf, STREAM_BUFFER_SIZE);
-      buflen = read(fileno(f), buf, STREAM_BUFFER_SIZE);
-      while(buflen > 0){
-        len=write(fileno(stdout), buf, buflen);
-        total_len=total_len + buflen;
-        if (len != buflen){
-          g_critical("Stream failed during transmition of file: %s",filename);
-          exit(EXIT_FAILURE);
-        }
-//        buflen = not_compressed ? read(fileno(f), buf, STREAM_BUFFER_SIZE): gzread((gzFile)f, buf, STREAM_BUFFER_SIZE);
-        buflen = read(fileno(f), buf, STREAM_BUFFER_SIZE);
-      }
-//      if (not_compressed && total_len != sz){
-//      if (total_len != sz){
-//        g_critical("Data transmited for %s doesn't match. File size: %d Transmited: %d",filename,sz,total_len);
-//        exit(EXIT_FAILURE);
-//      }else{
-        diff=g_date_time_difference(g_date_time_new_now_local(),start_time)/G_TIME_SPAN_SECOND;
-        total_diff=g_date_time_difference(g_date_time_new_now_local(),total_start_time)/G_TIME_SPAN_SECOND;
-        if (diff > 0){
-          g_message("File %s transfered in %ld seconds at %ld MB/s | Global: %ld MB/s",filename,diff,total_len/1024/1024/diff,total_diff!=0?total_size/1024/1024/total_diff:total_size/1024/1024);
-        }else{
-          g_message("File %s transfered | Global: %ld MB/s",filename,total_diff!=0?total_size/1024/1024/total_diff:total_size/1024/1024);
-        }
-        total_size+=total_len;
-//      }
-      fclose(f);
-    }
+    stream_file_blocks(filename);
     if (no_delete == FALSE){
       remove(filename);
     }
+    g_free(filename);
   }
-  total_diff=g_date_time_difference(g_date_time_new_now_local(),total_start_time)/G_TIME_SPAN_SECOND;
-  g_message("All data transfered was %ld at a rate of %ld MB/s",total_size,total_diff!=0?total_size/1024/1024/total_diff:total_size/1024/1024);
   return NULL;
 }
 
 void initialize_stream(){
-  stream_queue = g_async_queue_new();
-  stream_thread = g_thread_create((GThreadFunc)process_stream, stream_queue, TRUE, NULL);
+  initialize_crc32c();
+  initialize_stream_queue(0);
+  stream_block_queue = g_async_queue_new();
+  stream_memory_mutex = g_mutex_new();
+  stream_memory_cond = g_cond_new();
+  stream_multiplexer_thread = g_thread_create((GThreadFunc)process_stream_blocks, NULL, TRUE, NULL);
+  stream_thread = g_thread_create((GThreadFunc)process_stream, NULL, TRUE, NULL);
 }
 
 void wait_stream_to_finish(){
   g_thread_join(stream_thread);
+  g_async_queue_push(stream_block_queue, g_new0(struct stream_block, 1));
+  g_thread_join(stream_multiplexer_thread);
 }
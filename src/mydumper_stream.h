@@ -18,4 +18,6 @@
 
 void initialize_stream();
 void wait_stream_to_finish();
+void stream_block(const gchar *name, GString *data);
+void stream_end_of_file(const gchar *name);
 //void *process_stream(void *data);
@@ -36,11 +36,7 @@
 #include <stdarg.h>
 #include <errno.h>
 #include <time.h>
-#ifdef ZWRAP_USE_ZSTD
-#include "../zstd/zstd_zlibwrapper.h"
-#else
 #include <zlib.h>
-#endif
 #include <pcre.h>
 #include <signal.h>
 #include <glib/gstdio.h>
@@ -63,11 +59,19 @@
 
 #include "mydumper_start_dump.h"
 #include "mydumper_jobs.h"
+#include "mydumper_chunks.h"
+#include "mydumper_scheduler.h"
+#include "mydumper_escape.h"
 #include "mydumper_common.h"
 #include "mydumper_stream.h"
 #include "mydumper_database.h"
+#include "mydumper_catalog.h"
 #include "mydumper_working_thread.h"
 #include "mydumper_masquerade.h"
+#include "mydumper_column_plan.h"
+#include "mydumper_writer.h"
+#include "mydumper_dictionary.h"
+#include "compression.h"
 /* Some earlier versions of MySQL do not yet define MYSQL_TYPE_JSON */
 #ifndef MYSQL_TYPE_JSON
 #define MYSQL_TYPE_JSON 245
@@ -75,7 +79,6 @@
 
 GMutex *init_mutex = NULL;
 /* Program options */
-extern GAsyncQueue *stream_queue;
 guint complete_insert = 0;
 gboolean load_data = FALSE;
 gboolean csv = FALSE;
@@ -95,6 +98,7 @@ guint rows_per_file = 0;
 gboolean use_savepoints = FALSE;
 const gchar *insert_statement=INSERT;
 extern gboolean dump_triggers;
+extern guint64 chunk_target_bytes;
 extern gboolean stream;
 extern int detected_server;
 extern gboolean no_data;
@@ -117,8 +121,9 @@ int skip_tz = 0;
 extern int need_dummy_read;
 extern int need_dummy_toku_read;
 extern int compress_output;
+extern enum compression_method compression_method;
+extern gboolean compress_dictionary;
 int sync_wait = -1;
-extern gboolean ignore_generated_fields;
 extern gboolean no_schemas;
 gboolean dump_events = FALSE;
 gboolean dump_routines = FALSE;
@@ -127,6 +132,7 @@ extern gboolean less_locking;
 gboolean success_on_1146 = FALSE;
 gboolean insert_ignore = FALSE;
 gboolean replace = FALSE;
+gboolean hex_blob = FALSE;
 
 extern GList *innodb_tables;
 GMutex *innodb_tables_mutex = NULL;
@@ -161,6 +167,7 @@ GMutex *ll_mutex = NULL;
 
 extern guint errors;
 guint statement_size = 1000000;
+extern guint num_write_threads;
 guint chunk_filesize = 0;
 int build_empty_files = 0;
 
@@ -193,6 +200,8 @@ static GOptionEntry working_thread_entries[] = {
      "Dump rows with INSERT IGNORE", NULL},
     {"replace", 0, 0 , G_OPTION_ARG_NONE, &replace,
      "Dump rows with REPLACE", NULL},
+    {"hex-blob", 0, 0, G_OPTION_ARG_NONE, &hex_blob,
+     "Dump binary columns using hexadecimal notation", NULL},
     {"exit-if-broken-table-found", 0, 0, G_OPTION_ARG_NONE, &exit_if_broken_table_found,
       "Exits if a broken table has been found", NULL},
     {"success-on-1146", 0, 0, G_OPTION_ARG_NONE, &success_on_1146,
@@ -204,6 +213,11 @@ static GOptionEntry working_thread_entries[] = {
      NULL},
     {"statement-size", 's', 0, G_OPTION_ARG_INT, &statement_size,
      "Attempted size of INSERT statement in bytes, default 1000000", NULL},
+    {"write-threads", 0, 0, G_OPTION_ARG_INT, &num_write_threads,
+     "Threads that compress blocks of the data files in parallel and write "
+     "them, so the --threads connections don't wait for them. Default 0, each "
+     "thread writes its own",
+     NULL},
     {"chunk-filesize", 'F', 0, G_OPTION_ARG_INT, &chunk_filesize,
      "Split tables into chunks of this output file size. This value is in MB",
      NULL},
@@ -239,13 +253,10 @@ static GOptionEntry working_thread_entries[] = {
     {NULL, 0, 0, G_OPTION_ARG_NONE, NULL, NULL, NULL}};
 
 void dump_database_thread(MYSQL *, struct configuration*, struct database *);
-gchar *get_primary_key_string(MYSQL *conn, char *database, char *table);
-GList *get_chunks_for_table(MYSQL *, char *, char *,
-                            struct configuration *conf);
-guint64 estimate_count(MYSQL *conn, char *database, char *table, char *field,
-                       char *from, char *to);
-guint64 write_table_data_into_file(MYSQL *conn, struct table_job *tj);
-void write_table_job_into_file(MYSQL *conn, struct table_job * tj);
+guint64 estimate_count(MYSQL *conn, char *database, char *table,
+                       char *partition, char *field, char *from, char *to);
+guint64 write_table_data_into_file(struct thread_data *td, struct table_job *tj);
+void write_table_job_into_file(struct thread_data *td, struct table_job * tj);
 
 void load_working_thread_entries(GOptionGroup *main_group){
   g_option_group_add_entries(main_group, working_thread_entries);
@@ -338,7 +349,7 @@ void initialize_working_thread(){
 
   /* savepoints workaround to avoid metadata locking issues
      doesnt work for chuncks */
-  if (rows_per_file && use_savepoints) {
+  if ((rows_per_file || chunk_target_bytes) && use_savepoints) {
     use_savepoints = FALSE;
     g_warning("--use-savepoints disabled by --rows");
   }
@@ -352,15 +363,25 @@ void initialize_working_thread(){
     m_close=(void *) &fclose;
     m_write=(void *)&write_file;
     compress_extension=g_strdup("");
+  } else if (compression_method == COMPRESSION_ZSTD) {
+    m_open=&zstd_open;
+    m_close=&zstd_close;
+    m_write=&zstd_write;
+    compress_extension = g_strdup(get_compression_extension(compression_method));
+  } else if (compression_method == COMPRESSION_LZ4) {
+    m_open=&lz4_open;
+    m_close=&lz4_close;
+    m_write=&lz4_write;
+    compress_extension = g_strdup(get_compression_extension(compression_method));
   } else {
-    m_open=(void *) &gzopen;
+    m_open=&gzip_open;
     m_close=(void *) &gzclose;
     m_write=(void *)&gzwrite;
-#ifdef ZWRAP_USE_ZSTD
-    compress_extension = g_strdup(".zst");
-#else
-    compress_extension = g_strdup(".gz");
-#endif
+    compress_extension = g_strdup(get_compression_extension(compression_method));
+  }
+  if (compress_dictionary && (!compress_output || compression_method != COMPRESSION_ZSTD)) {
+    g_warning("--compress-dictionary disabled, it needs --compress=zstd");
+    compress_dictionary = FALSE;
   }
   if (dump_checksums){
     data_checksums = TRUE;
@@ -385,10 +406,16 @@ void initialize_working_thread(){
 void free_table_job(struct table_job *tj){
   if (tj->table)
     g_free(tj->table);
+  if (tj->partition)
+    g_free(tj->partition);
   if (tj->where)
     g_free(tj->where);
   if (tj->order_by)
     g_free(tj->order_by);
+  if (tj->chunk_step)
+    free_integer_step(tj->chunk_step);
+  if (tj->shared)
+    release_table_job_shared(tj->shared);
 //  if (tj->filename)
 //    g_free(tj->filename);
 //  g_free(tj);
@@ -415,17 +442,46 @@ void thd_JOB_DUMP_DATABASE(struct configuration *conf, struct thread_data *td, s
   }
 }
 
+void dump_table_job(struct thread_data *td, struct table_job *tj){
+  if (tj->chunk_step || tj->keyset){
+    while (get_next_chunk(td->thrconn, tj)){
+      message_dumping_data(td,tj);
+      write_table_job_into_file(td, tj);
+    }
+  }else{
+    message_dumping_data(td,tj);
+    write_table_job_into_file(td, tj);
+  }
+}
+
+gboolean dump_stolen_table_job(struct thread_data *td){
+  struct table_job *tj = steal_table_job();
+  if (!tj)
+    return FALSE;
+  g_message("Thread %d splitting the pending rows of `%s`.`%s`", td->thread_id, tj->database, tj->table);
+  dump_table_job(td, tj);
+  release_table_thread(tj->dbt);
+  free_table_job(tj);
+  g_free(tj);
+  return TRUE;
+}
+
 void thd_JOB_DUMP(struct thread_data *td, struct job *job){
   struct table_job *tj = (struct table_job *)job->job_data;
-  message_dumping_data(td,tj);
+  // InnoDB jobs are taken from the scheduler, biggest first
+  gboolean scheduled = tj == NULL;
+  if (scheduled)
+    tj = get_scheduled_table_job();
   if (use_savepoints && mysql_query(td->thrconn, "SAVEPOINT mydumper")) {
     g_critical("Savepoint failed: %s", mysql_error(td->thrconn));
   }
-  write_table_job_into_file(td->thrconn, tj);
+  dump_table_job(td, tj);
   if (use_savepoints &&
       mysql_query(td->thrconn, "ROLLBACK TO SAVEPOINT mydumper")) {
     g_critical("Rollback to savepoint failed: %s", mysql_error(td->thrconn));
   }
+  if (scheduled)
+    release_table_thread(tj->dbt);
   free_table_job(tj);
   g_free(job);
 }
@@ -462,8 +518,7 @@ void thd_JOB_LOCK_DUMP_NON_INNODB(struct configuration *conf, struct thread_data
   }
   for (glj = mj->table_job_list; glj != NULL; glj = glj->next) {
     tj = (struct table_job *)glj->data;
-    message_dumping_data(td,tj);
-    write_table_job_into_file(td->thrconn, tj);
+    dump_table_job(td, tj);
     free_table_job(tj);
     g_free(tj);
   }
@@ -532,6 +587,8 @@ void *working_thread(struct thread_data *td) {
   g_mutex_lock(init_mutex);
   td->thrconn = mysql_init(NULL);
   g_mutex_unlock(init_mutex);
+  td->statement = g_string_sized_new(statement_size);
+  td->buffers = new_output_buffers();
 
   initialize_thread(td);
   execute_gstring(td->thrconn, set_session);
@@ -574,6 +631,9 @@ void *working_thread(struct thread_data *td) {
 
   GMutex *resume_mutex=NULL;
 
+  if (!td->less_locking_stage)
+    register_job_queue_consumer();
+
   for (;;) {
     if (conf->pause_resume){
       resume_mutex = (GMutex *)g_async_queue_try_pop(conf->pause_resume);
@@ -585,7 +645,16 @@ void *working_thread(struct thread_data *td) {
       }
     }
 
-    job = (struct job *)g_async_queue_pop(td->queue);
+    /* Threads that ran out of jobs help with the ranges that are still
+       being dumped by other threads */
+    job = (struct job *)g_async_queue_try_pop(td->queue);
+    if (job == NULL) {
+      if (!td->less_locking_stage && !shutdown_triggered && dump_stolen_table_job(td))
+        continue;
+      job = (struct job *)g_async_queue_pop(td->queue);
+    }
+    if (!td->less_locking_stage)
+      notify_job_queue_consumed(td->queue);
     if (shutdown_triggered && (job->type != JOB_SHUTDOWN)) {
       continue;
     }
@@ -629,7 +698,11 @@ void *working_thread(struct thread_data *td) {
       do_JOB_SCHEMA_POST(td,job);
       break;
     case JOB_SHUTDOWN:
+      if (!td->less_locking_stage)
+        while (!shutdown_triggered && dump_stolen_table_job(td));
       g_message("Thread %d shutting down", td->thread_id);
+      if (!td->less_locking_stage)
+        unregister_job_queue_consumer();
       if (td->less_locking_stage){
         g_mutex_lock(ll_mutex);
         less_locking_threads--;
@@ -641,6 +714,8 @@ void *working_thread(struct thread_data *td) {
       }
       if (td->thrconn)
         mysql_close(td->thrconn);
+      g_string_free(td->statement, TRUE);
+      free_output_buffers(td->buffers);
       g_free(job);
       mysql_thread_end();
       return NULL;
@@ -656,61 +731,19 @@ void *working_thread(struct thread_data *td) {
   return NULL;
 }
 
-GString *get_insertable_fields(MYSQL *conn, char *database, char *table) {
-  MYSQL_RES *res = NULL;
-  MYSQL_ROW row;
-
-  GString *field_list = g_string_new("");
-
-  gchar *query =
-      g_strdup_printf("select COLUMN_NAME from information_schema.COLUMNS "
-                      "where TABLE_SCHEMA='%s' and TABLE_NAME='%s' and extra "
-                      "not like '%%VIRTUAL GENERATED%%' and extra not like '%%STORED GENERATED%%'",
-                      database, table);
-  mysql_query(conn, query);
-  g_free(query);
-
-  res = mysql_store_result(conn);
-  gboolean first = TRUE;
-  while ((row = mysql_fetch_row(res))) {
-    if (first) {
-      first = FALSE;
-    } else {
-      g_string_append(field_list, ",");
-    }
-
-    gchar *tb = g_strdup_printf("`%s`", row[0]);
-    g_string_append(field_list, tb);
-    g_free(tb);
-  }
-  mysql_free_result(res);
-
-  return field_list;
-}
-
-GList *get_anonymized_function_for(MYSQL *conn, gchar *database, gchar *table){
+GList *get_anonymized_function_for(struct db_table *dbt){
   // TODO #364: this is the place where we need to link the column between file loaded and dbt.
   // Currently, we are using identity_function, which return the same data.
   // Key: `database`.`table`.`column`
 
-  MYSQL_RES *res = NULL;
-  MYSQL_ROW row;
-
-  gchar *query =
-      g_strdup_printf("select COLUMN_NAME from information_schema.COLUMNS "
-                      "where TABLE_SCHEMA='%s' and TABLE_NAME='%s' ORDER BY ORDINAL_POSITION;",
-                      database, table);
-  mysql_query(conn, query);
-  g_free(query);
-
   GList *anonymized_function_list=NULL;
-  res = mysql_store_result(conn);
-  gchar * k = g_strdup_printf("`%s`.`%s`",database,table);
+  GList *iter;
+  gchar * k = g_strdup_printf("`%s`.`%s`",dbt->database->name,dbt->table);
   GHashTable *ht = g_hash_table_lookup(all_anonymized_function,k);
   fun_ptr2 f;
   if (ht){
-    while ((row = mysql_fetch_row(res))) {
-      f=(fun_ptr2)g_hash_table_lookup(ht,row[0]);
+    for (iter = dbt->catalog->columns; iter != NULL; iter = iter->next) {
+      f=(fun_ptr2)g_hash_table_lookup(ht,iter->data);
       if (f  != NULL){
         anonymized_function_list=g_list_append(anonymized_function_list,f);
       }else{
@@ -718,64 +751,45 @@ GList *get_anonymized_function_for(MYSQL *conn, gchar *database, gchar *table){
       }
     }
   }
-  mysql_free_result(res);
   g_free(k);
   return anonymized_function_list;
 }
 
-gboolean detect_generated_fields(MYSQL *conn, gchar *database, gchar* table) {
-  MYSQL_RES *res = NULL;
-  MYSQL_ROW row;
-
-  gboolean result = FALSE;
-  if (ignore_generated_fields)
-    return FALSE;
-
-  gchar *query = g_strdup_printf(
-      "select COLUMN_NAME from information_schema.COLUMNS where "
-      "TABLE_SCHEMA='%s' and TABLE_NAME='%s' and extra like '%%GENERATED%%' and extra not like '%%DEFAULT_GENERATED%%'",
-      database, table);
-
-  mysql_query(conn, query);
-  g_free(query);
-
-  res = mysql_store_result(conn);
-  if (res == NULL){
-    return FALSE;
-  }
-
-  if ((row = mysql_fetch_row(res))) {
-    result = TRUE;
-  }
-  mysql_free_result(res);
-
-  return result;
-}
-
-struct db_table *new_db_table( MYSQL *conn, struct database *database, char *table, char *datalength){
+struct db_table *new_db_table( MYSQL *conn, struct database *database, char *table, char *estimated_rows, char *datalength){
   struct db_table *dbt = g_new(struct db_table, 1);
   dbt->database = database;
   dbt->table = g_strdup(table);
   dbt->table_filename = get_ref_table(dbt->table);
   dbt->rows_lock= g_mutex_new();
   dbt->escaped_table = escape_string(conn,dbt->table);
-  dbt->anonymized_function=get_anonymized_function_for(conn, dbt->database->name, dbt->table);
-  dbt->has_generated_fields = detect_generated_fields(conn, dbt->database->escaped, dbt->escaped_table);
+  dbt->catalog = get_table_catalog(conn, database, dbt->table);
+  dbt->anonymized_function=get_anonymized_function_for(dbt);
+  dbt->column_plan=NULL;
+  dbt->dictionary=new_table_dictionary();
+  dbt->has_generated_fields = dbt->catalog->has_generated_fields;
   if (dbt->has_generated_fields) {
-    dbt->select_fields = get_insertable_fields(conn, dbt->database->escaped, dbt->escaped_table);
+    dbt->select_fields = g_string_new(dbt->catalog->insertable_fields->str);
   } else {
     dbt->select_fields = g_string_new("*");
   }
 
   dbt->rows=0;
+  dbt->chunk_type=NONE;
+  dbt->chunk_part=0;
+  dbt->chunk_rows=0;
+  dbt->current_threads=0;
   if (!datalength)
     dbt->datalength = 0;
   else
     dbt->datalength = g_ascii_strtoull(datalength, NULL, 10);
+  if (!estimated_rows)
+    dbt->estimated_rows = 0;
+  else
+    dbt->estimated_rows = g_ascii_strtoull(estimated_rows, NULL, 10);
   return dbt; 
 }
 
-void new_table_to_dump(MYSQL *conn, struct configuration *conf, gboolean is_view, struct database * database, char *table, char *datalength, gchar *ecol){
+void new_table_to_dump(MYSQL *conn, struct configuration *conf, gboolean is_view, struct database * database, char *table, char *estimated_rows, char *datalength, gchar *ecol){
     /* Green light! */
   g_mutex_lock(database->ad_mutex);
   if (!database->already_dumped){
@@ -784,7 +798,7 @@ void new_table_to_dump(MYSQL *conn, struct configuration *conf, gboolean is_view
   }
   g_mutex_unlock(database->ad_mutex);
 
-  struct db_table *dbt = new_db_table( conn, database, table, datalength);// (*row)[0], (*row)[6]);
+  struct db_table *dbt = new_db_table( conn, database, table, estimated_rows, datalength);// (*row)[0], (*row)[4], (*row)[6]);
 
  // if is a view we care only about schema
   if (!is_view) {
@@ -1026,7 +1040,7 @@ void dump_database_thread(MYSQL *conn, struct configuration *conf, struct databa
     if (!dump)
       continue;
 
-    new_table_to_dump(conn, conf, is_view, database, row[0], row[6], row[ecol]);
+    new_table_to_dump(conn, conf, is_view, database, row[0], row[4], row[6], row[ecol]);
 
   }
 
@@ -1044,9 +1058,9 @@ void dump_database_thread(MYSQL *conn, struct configuration *conf, struct databa
   return;
 }
 
-void write_table_job_into_file(MYSQL *conn, struct table_job *tj) {
+void write_table_job_into_file(struct thread_data *td, struct table_job *tj) {
   guint64 rows_count =
-      write_table_data_into_file(conn, tj);
+      write_table_data_into_file(td, tj);
 
   if (!rows_count)
     g_message("Empty table %s.%s", tj->database, tj->table);
@@ -1063,6 +1077,26 @@ void append_columns (GString *statement, MYSQL_FIELD *fields, guint num_fields){
   }
 }
 
+/* Hex columns are read into a variable and decoded in the SET clause */
+void append_load_data_columns(GString *statement, MYSQL_FIELD *fields, guint num_fields){
+  GString *set = g_string_new(NULL);
+  guint i = 0;
+  for (i = 0; i < num_fields; ++i) {
+    if (i > 0) {
+      g_string_append_c(statement, ',');
+    }
+    if (is_hex_blob_field(&fields[i])) {
+      g_string_append_printf(statement, "@hex_%u", i);
+      g_string_append_printf(set, "%s`%s`=UNHEX(@hex_%u)", set->len ? "," : " SET ", fields[i].name, i);
+    } else {
+      g_string_append_printf(statement, "`%s`", fields[i].name);
+    }
+  }
+  g_string_append_c(statement, ')');
+  g_string_append(statement, set->str);
+  g_string_free(set, TRUE);
+}
+
 void append_insert (gboolean condition, GString *statement, char *table, MYSQL_FIELD *fields, guint num_fields){
   if (condition) {
     g_string_printf(statement, "%s INTO `%s` (", insert_statement, table);
@@ -1073,12 +1107,12 @@ void append_insert (gboolean condition, GString *statement, char *table, MYSQL_F
   }
 }
 
-gboolean write_data(FILE *file, GString *data) {
+gboolean write_buffer(FILE *file, const gchar *data, gsize len) {
   size_t written = 0;
   ssize_t r = 0;
   gboolean second_write_zero = FALSE;
-  while (written < data->len) {
-    r=m_write(file, data->str + written, data->len);
+  while (written < len) {
+    r=m_write(file, data + written, len - written);
     if (r < 0) {
       g_critical("Couldn't write data to a file: %s", strerror(errno));
       errors++;
@@ -1100,6 +1134,10 @@ gboolean write_data(FILE *file, GString *data) {
   return TRUE;
 }
 
+gboolean write_data(FILE *file, GString *data) {
+  return write_buffer(file, data->str, data->len);
+}
+
 void initialize_load_data_statement(GString *statement, gchar * table, gchar *basename, MYSQL_FIELD * fields, guint num_fields){
   g_string_append_printf(statement, "LOAD DATA LOCAL INFILE '%s' REPLACE INTO TABLE `%s` ", basename, table);
   if (fields_terminated_by_ld)
@@ -1112,8 +1150,8 @@ void initialize_load_data_statement(GString *statement, gchar * table, gchar *ba
   if (lines_starting_by_ld)
     g_string_append_printf(statement, "STARTING BY '%s' ",lines_starting_by_ld);
   g_string_append_printf(statement, "TERMINATED BY '%s' (", lines_terminated_by_ld);
-  append_columns(statement,fields,num_fields);
-  g_string_append(statement,");\n");
+  append_load_data_columns(statement,fields,num_fields);
+  g_string_append(statement,";\n");
 }
 
 void initialize_sql_statement(GString *statement){
@@ -1133,299 +1171,262 @@ void initialize_sql_statement(GString *statement){
   }
 }
 
-void write_column_into_string( MYSQL *conn, gchar **column, MYSQL_FIELD field, gulong length,GString *escaped, GString *statement_row, gchar * (*fun_ptr_i)(gchar **)){
-  if (load_data){
-    if (!*column) {
-      g_string_append(statement_row, "\\N");
-    }else if (field.type != MYSQL_TYPE_LONG && field.type != MYSQL_TYPE_LONGLONG  && field.type != MYSQL_TYPE_INT24  && field.type != MYSQL_TYPE_SHORT ){
-      g_string_append(statement_row,fields_enclosed_by);
-      g_string_set_size(escaped, length * 2 + 1);
-      mysql_real_escape_string(conn, escaped->str, fun_ptr_i(column), length);
-      g_string_append(statement_row,escaped->str);
-      g_string_append(statement_row,fields_enclosed_by);
-    }else
-      g_string_append(statement_row, fun_ptr_i(column));
-  }else{
-    /* Don't escape safe formats, saves some time */
-    if (!*column) {
-      g_string_append(statement_row, "NULL");
-    } else if (field.flags & NUM_FLAG) {
-      g_string_append(statement_row, fun_ptr_i(column));
-    } else {
-      /* We reuse buffers for string escaping, growing is expensive just at
-       * the beginning */
-      g_string_set_size(escaped, length * 2 + 1);
-      mysql_real_escape_string(conn, escaped->str, fun_ptr_i(column), length);
-      if (field.type == MYSQL_TYPE_JSON)
-        g_string_append(statement_row, "CONVERT(");
-      g_string_append_c(statement_row, '\"');
-      g_string_append(statement_row, escaped->str);
-      g_string_append_c(statement_row, '\"');
-      if (field.type == MYSQL_TYPE_JSON)
-        g_string_append(statement_row, " USING UTF8MB4)");
-    }
+/* The first column goes out of the loop so there is no check per cell */
+void write_row_into_string(MYSQL *conn, struct column_plan *plan, MYSQL_ROW row, gulong *lengths, gboolean fast_escape, GString *statement_row){
+  struct column_encoder *ce = plan->encoders;
+  guint i = 0;
+  g_string_append(statement_row, lines_starting_by);
+  ce->encode(conn, fast_escape, statement_row, ce, &(row[0]), lengths[0]);
+  for (i = 1; i < plan->num_columns; i++) {
+    g_string_append(statement_row, fields_terminated_by);
+    ce++;
+    ce->encode(conn, fast_escape, statement_row, ce, &(row[i]), lengths[i]);
   }
+  g_string_append(statement_row, lines_terminated_by);
 }
 
-void write_row_into_string(MYSQL *conn, struct db_table * dbt, MYSQL_ROW row, MYSQL_FIELD *fields, gulong *lengths, guint num_fields, GString *escaped, GString *statement_row){
-  guint i = 0;
-  g_string_append(statement_row, lines_starting_by);
-  GList *f = dbt->anonymized_function;
-    gchar * (*fun_ptr_i)(gchar **) = &identity_function;
-    for (i = 0; i < num_fields; i++) {
-      if (f){
-        fun_ptr_i=f->data;
-        f=f->next;
-      }
-      write_column_into_string( conn, &(row[i]), fields[i], lengths[i], escaped, statement_row, fun_ptr_i);
-      if (i < num_fields - 1) {
-        g_string_append(statement_row, fields_terminated_by);
-      }
-    }
-    g_string_append_printf(statement_row,"%s", lines_terminated_by);
+/* Every chunk of the table returns the same fields, so the plan is built by
+ * the first one */
+struct column_plan *get_column_plan(struct db_table *dbt, MYSQL_FIELD *fields, guint num_fields){
+  g_mutex_lock(dbt->rows_lock);
+  if (!dbt->column_plan)
+    dbt->column_plan = new_column_plan(dbt->anonymized_function, fields, num_fields);
+  g_mutex_unlock(dbt->rows_lock);
+  return dbt->column_plan;
 }
 
-guint64 write_row_into_file_in_load_data_mode(MYSQL *conn, MYSQL_RES *result, struct db_table * dbt, guint nchunk){
+guint64 write_row_into_file_in_load_data_mode(struct thread_data *td, MYSQL_RES *result, struct table_job * tj){
+  struct db_table * dbt = tj->dbt;
+  MYSQL *conn = td->thrconn;
+  guint nchunk = tj->nchunk;
   guint num_fields = mysql_num_fields(result);
   guint64 num_rows=0;
-  GString *escaped = g_string_sized_new(3000);
+  gboolean fast_escape = can_use_fast_escape(conn);
   MYSQL_FIELD *fields = mysql_fetch_fields(result);
+  struct column_plan *plan = get_column_plan(dbt, fields, num_fields);
   MYSQL_ROW row;
   float filesize = 0;
-  guint sub_part=0;
-  GString *statement = g_string_sized_new(statement_size);
-  GString *statement_row = g_string_sized_new(0);
-  FILE *sql_file = NULL;
-  FILE *load_data_file = NULL;
+  guint sub_part=tj->sub_part;
+  // Rows go in place into the thread buffer, which is handed to the data
+  // file once it is full
+  GString *load_data_statement = g_string_sized_new(0);
+  gsize row_start = 0;
+  struct output_file *sql_file = NULL;
+  struct output_file *load_data_file = NULL;
   gchar * sql_fn = NULL;
   gchar * load_data_fn = NULL;
+  struct dictionary_samples *samples = NULL;
   gboolean first_time = TRUE;
+  g_string_set_size(td->statement, 0);
   while ((row = mysql_fetch_row(result))) {
     gulong *lengths = mysql_fetch_lengths(result);
     num_rows++;
     if ((chunk_filesize &&
         (guint)ceil((float)filesize / 1024 / 1024) >
             chunk_filesize) || first_time) {
+      if (td->statement->len > 0) {
+        if (!write_output_buffer(load_data_file, td->buffers, &td->statement, td->statement->len, td->statement->len)) {
+          g_critical("Could not write out data for %s.%s", dbt->database->name, dbt->table);
+          goto cleanup;
+        }
+      }
+      if (!first_time){
+        close_output_file(sql_file);
+        close_output_file(load_data_file);
+        sql_file = NULL;
+        load_data_file = NULL;
+        if (stream && data_files_on_disk()) {
+          stream_queue_push(sql_fn);
+          stream_queue_push(load_data_fn);
+        }
+      }
       load_data_fn=build_filename(dbt->database->filename, dbt->table_filename, nchunk, sub_part, "dat");
       sql_fn = build_data_filename(dbt->database->filename, dbt->table_filename, nchunk, sub_part);
       char * basename=g_path_get_basename(load_data_fn);
-      initialize_sql_statement(statement);
-      initialize_load_data_statement(statement, dbt->table, basename, fields, num_fields);
+      g_string_set_size(load_data_statement, 0);
+      initialize_sql_statement(load_data_statement);
+      initialize_load_data_statement(load_data_statement, dbt->table, basename, fields, num_fields);
       g_free(basename);
-      if (!compress_output) {
-        if (!first_time){
-          fclose((FILE *)sql_file);
-          fclose((FILE *)load_data_file);
-          if (stream) {
-            g_async_queue_push(stream_queue, g_strdup(sql_fn));
-            g_async_queue_push(stream_queue, g_strdup(load_data_fn));
-          }
-        }
-        sql_file = g_fopen(sql_fn, "a");
-        if (!sql_file){
-          g_critical("Could not open file: %s", sql_fn);
-          exit(EXIT_FAILURE);
-        }
-        load_data_file = g_fopen(load_data_fn, "a");
-        if (!load_data_file){
-          g_critical("Could not open file: %s", load_data_fn);
-          exit(EXIT_FAILURE);
-        }
-      } else {
-        if (!first_time){
-          gzclose((gzFile)sql_file);
-          gzclose((gzFile)load_data_file);
-          if (stream) {
-            g_async_queue_push(stream_queue, g_strdup(sql_fn));
-            g_async_queue_push(stream_queue, g_strdup(load_data_fn));
-          }
-        }
-        load_data_file = (void *)gzopen(load_data_fn, "a");
-        sql_file = (void *)gzopen(sql_fn, "a");
-      }
-      if (!write_data(sql_file, statement)) {
+      end_dictionary_samples(dbt, samples);
+      samples = start_dictionary_samples(dbt);
+      sql_file = open_output_file(sql_fn, "a", NULL);
+      load_data_file = open_output_file(load_data_fn, "a", get_dictionary(dbt));
+      if (!write_output(sql_file, load_data_statement->str, load_data_statement->len)) {
         g_critical("Could not write out data for %s.%s", dbt->database->name, dbt->table);
-        return num_rows;
+        goto cleanup;
       }
-      g_string_set_size(statement, 0);
       filesize=0;
       first_time=FALSE;
-      sub_part++;
+      sub_part = tj->sub_part_counter ? (guint)g_atomic_int_add(tj->sub_part_counter, 1) : sub_part + 1;
     }
-    g_string_set_size(statement_row, 0);
-    write_row_into_string(conn, dbt, row, fields, lengths, num_fields, escaped, statement_row);
-    filesize+=statement_row->len+1;
-    g_string_append(statement, statement_row->str);
+    row_start = td->statement->len;
+    write_row_into_string(conn, plan, row, lengths, fast_escape, td->statement);
+    add_dictionary_sample(samples, td->statement->str + row_start, td->statement->len - row_start);
+    filesize+=td->statement->len-row_start+1;
     /* INSERT statement is closed before over limit but this is load data, so we only need to flush the data to disk*/
-    if (statement->len + statement_row->len + 1 > statement_size) {
-      if (!write_data(load_data_file, statement)) {
+    if (td->statement->len + 1 > statement_size) {
+      if (!write_output_buffer(load_data_file, td->buffers, &td->statement, td->statement->len, td->statement->len)) {
         g_critical("Could not write out data for %s.%s", dbt->database->name, dbt->table);
-        return num_rows;
+        goto cleanup;
       }
-      g_string_set_size(statement, 0); 
     }
   }
-  if (statement->len > 0)
-    if (!write_data(load_data_file, statement)) {
+  if (td->statement->len > 0)
+    if (!write_output_buffer(load_data_file, td->buffers, &td->statement, td->statement->len, td->statement->len)) {
       g_critical("Could not write out data for %s.%s", dbt->database->name, dbt->table);
-      return num_rows;
+      goto cleanup;
     }
-      if (!compress_output) {
-          if (sql_file) { 
-            fclose((FILE *)sql_file);
-            if (stream && sql_fn) g_async_queue_push(stream_queue, g_strdup(sql_fn));
-          }
-          if (load_data_file){
-            fclose((FILE *)load_data_file);
-            if (stream && load_data_fn) g_async_queue_push(stream_queue, g_strdup(load_data_fn));
-          }
-        }else{
-          if (sql_file) {
-            gzclose((gzFile)sql_file);
-            if (stream && sql_fn) g_async_queue_push(stream_queue, g_strdup(sql_fn));
-          }
-          if (load_data_file){
-            gzclose((gzFile)load_data_file);
-            if (stream && load_data_fn) g_async_queue_push(stream_queue, g_strdup(load_data_fn));
-          }
-}
+  if (sql_file) {
+    close_output_file(sql_file);
+    sql_file = NULL;
+    if (stream && data_files_on_disk() && sql_fn) stream_queue_push(sql_fn);
+  }
+  if (load_data_file){
+    close_output_file(load_data_file);
+    load_data_file = NULL;
+    if (stream && data_files_on_disk() && load_data_fn) stream_queue_push(load_data_fn);
+  }
+cleanup:
+  if (sql_file)
+    close_output_file(sql_file);
+  if (load_data_file)
+    close_output_file(load_data_file);
+  end_dictionary_samples(dbt, samples);
+  g_string_free(load_data_statement, TRUE);
   return num_rows;
 }
 
+/* Writes an INSERT with the first length bytes of the thread buffer as its
+ * values, preceded by the file header when it opens the file. The buffer is
+ * left with the bytes from keep_from on. */
+gboolean write_insert_statement(struct thread_data *td, struct output_file *sql_file, GString *file_header, GString *insert, gsize length, gsize keep_from){
+  return (!file_header || write_output(sql_file, file_header->str, file_header->len)) &&
+         write_output(sql_file, insert->str, insert->len) &&
+         write_output_buffer(sql_file, td->buffers, &td->statement, length, keep_from) &&
+         write_output(sql_file, statement_terminated_by, strlen(statement_terminated_by));
+}
 
-guint64 write_row_into_file_in_sql_mode(MYSQL *conn, MYSQL_RES *result, struct db_table * dbt, guint nchunk, guint sections){
+guint64 write_row_into_file_in_sql_mode(struct thread_data *td, MYSQL_RES *result, struct table_job * tj){
+  struct db_table * dbt = tj->dbt;
+  MYSQL *conn = td->thrconn;
   // There are 2 possible options to chunk the files:
   // - no chunk: this means that will be just 1 data file
   // - chunk_filesize: this function will be spliting the per filesize, this means that multiple files will be created
   // Split by row is before this step
   // It could write multiple INSERT statments in a data file if statement_size is reached
   guint num_fields = mysql_num_fields(result);
-  GString *escaped = g_string_sized_new(3000);
+  gboolean fast_escape = can_use_fast_escape(conn);
   MYSQL_FIELD *fields = mysql_fetch_fields(result);
+  struct column_plan *plan = get_column_plan(dbt, fields, num_fields);
   MYSQL_ROW row;
   guint64 filesize = 0;
-  guint sub_part=0;
-  GString *statement = g_string_sized_new(statement_size);
-  GString *statement_row = g_string_sized_new(0);
-  FILE *sql_file = NULL;
+  guint sub_part=tj->sub_part;
+  // The thread buffer only holds the values of the current INSERT, every
+  // row followed by a comma. Rows are serialized in place and the header and
+  // terminator are written around them, so a full statement goes to the
+  // file without being copied.
+  GString *file_header = g_string_sized_new(0);
+  GString *insert = g_string_sized_new(0);
+  gsize row_start = 0;
+  struct output_file *sql_file = NULL;
   gchar * sql_fn = NULL;
   gulong *lengths = NULL;
   guint64 num_rows = 0;
-  guint64 num_rows_st = 0;  
   guint st_in_file = 0;
-  guint fn = nchunk;
+  guint fn = tj->nchunk;
+  struct dictionary_samples *samples = start_dictionary_samples(dbt);
+  initialize_sql_statement(file_header);
+  append_insert ((complete_insert || dbt->has_generated_fields), insert, dbt->table, fields, num_fields);
+  g_string_set_size(td->statement, 0);
   sql_fn = build_data_filename(dbt->database->filename, dbt->table_filename, fn, sub_part);
-  sql_file = m_open(sql_fn,"w"); 
+  sql_file = open_output_file(sql_fn,"w",get_dictionary(dbt));
   while ((row = mysql_fetch_row(result))) {
     lengths = mysql_fetch_lengths(result);
     num_rows++;
 
-    if (!statement->len) {
-      // if statement->len is 0 we consider that new statement needs to be written
-      // A file can be chunked by amount of rows or file size.
-      if (!st_in_file) {
-        // File Header
-        initialize_sql_statement(statement);
-        if (!write_data(sql_file, statement)) {
-          g_critical("Could not write out data for %s.%s", dbt->database->name, dbt->table);
-          return num_rows;
-        }
-      }
-      append_insert ((complete_insert || dbt->has_generated_fields), statement, dbt->table, fields, num_fields);
-      num_rows_st = 0;
-    }
-
-    if (statement_row->len) {
-      // previous row needs to be written
-      g_string_append(statement, statement_row->str);
-      g_string_set_size(statement_row, 0);
-      num_rows_st++;
-    }
-
-    write_row_into_string(conn, dbt, row, fields, lengths, num_fields, escaped, statement_row);
+    row_start = td->statement->len;
+    write_row_into_string(conn, plan, row, lengths, fast_escape, td->statement);
+    add_dictionary_sample(samples, td->statement->str + row_start, td->statement->len - row_start);
+    g_string_append_c(td->statement, ',');
 
-    if (statement->len + statement_row->len + 1 > statement_size) {
-      if (num_rows_st == 0) {
-        g_string_append(statement, statement_row->str);
-        g_string_set_size(statement_row, 0);
-        g_warning("Row bigger than statement_size for %s.%s", dbt->database->name,
-                  dbt->table);
-      }
-      g_string_append(statement, statement_terminated_by);
+    if (insert->len + td->statement->len <= statement_size)
+      continue;
 
-      if (!write_data(sql_file, statement)) {
-        g_critical("Could not write out data for %s.%s", dbt->database->name, dbt->table);
-        return num_rows;
+    // The statement ends where the row that crossed statement_size starts,
+    // and the row opens the next one
+    if (!row_start) {
+      g_warning("Row bigger than statement_size for %s.%s", dbt->database->name,
+                dbt->table);
+      row_start = td->statement->len;
+    }
+    if (!write_insert_statement(td, sql_file, st_in_file ? NULL : file_header, insert, row_start - 1, row_start)) {
+      g_critical("Could not write out data for %s.%s", dbt->database->name, dbt->table);
+      goto cleanup;
+    }
+    filesize+=insert->len+row_start;
+    st_in_file++;
+    if (chunk_filesize &&
+        (guint)ceil((float)filesize / 1024 / 1024) >
+            chunk_filesize) {
+      // Partitions and their chunks share the sub parts
+      if (tj->sub_part_counter){
+        sub_part = g_atomic_int_add(tj->sub_part_counter, 1);
+      }else if (tj->where == NULL){
+        fn++;
+      }else{
+        sub_part++;
       }
-      filesize+=statement->len+1;
-      st_in_file++;
-      if (chunk_filesize &&
-          (guint)ceil((float)filesize / 1024 / 1024) >
-              chunk_filesize) {
-        if (sections == 1){
-          fn++;
-        }else{
-          sub_part++;
-        }
-        m_close(sql_file);
-        if (stream) {
-          g_async_queue_push(stream_queue, g_strdup(sql_fn));
-        }
-        g_free(sql_fn);
-        sql_fn = build_data_filename(dbt->database->filename, dbt->table_filename, fn, sub_part);
-        sql_file = m_open(sql_fn,"w");
-        st_in_file = 0;
-	filesize = 0;
+      close_output_file(sql_file);
+      if (stream && data_files_on_disk()) {
+        stream_queue_push(sql_fn);
       }
-      g_string_set_size(statement, 0);
-    } else {
-      if (num_rows_st)
-        g_string_append_c(statement, ',');
-      g_string_append(statement, statement_row->str);
-      num_rows_st++;
-      g_string_set_size(statement_row, 0);
+      g_free(sql_fn);
+      // The rows of the file may complete the samples of the dictionary
+      end_dictionary_samples(dbt, samples);
+      samples = start_dictionary_samples(dbt);
+      sql_fn = build_data_filename(dbt->database->filename, dbt->table_filename, fn, sub_part);
+      sql_file = open_output_file(sql_fn,"w",get_dictionary(dbt));
+      st_in_file = 0;
+      filesize = 0;
     }
   }
-  if (statement_row->len > 0) {
-    /* this last row has not been written out */
-    if (!statement->len)
-      append_insert ((complete_insert || dbt->has_generated_fields), statement, dbt->table, fields, num_fields);
-    g_string_append(statement, statement_row->str);
-  }
 
-  if (statement->len > 0) {
-    g_string_append(statement, statement_terminated_by);
-    if (!write_data(sql_file, statement)) {
+  if (td->statement->len > 0) {
+    if (!write_insert_statement(td, sql_file, st_in_file ? NULL : file_header, insert, td->statement->len - 1, td->statement->len)) {
       g_critical(
           "Could not write out closing newline for %s.%s, now this is sad!",
           dbt->database->name, dbt->table);
-      return num_rows;
+      goto cleanup;
     }
     st_in_file++;
   }
-  if (!st_in_file && !build_empty_files) {
+  close_output_file(sql_file);
+  sql_file = NULL;
+  if (!data_files_on_disk()) {
+    // it was streamed or piped, or dropped when empty, as it was closed
+  } else if (!st_in_file && !build_empty_files) {
     // dropping the useless file
     if (remove(sql_fn)) {
       g_warning("Failed to remove empty file : %s\n", sql_fn);
     }
-  } else if (chunk_filesize) {
-    if (stream) {
-      g_async_queue_push(stream_queue, g_strdup(sql_fn));
-    }
-  }else{
-    if (stream) {
-      g_async_queue_push(stream_queue, g_strdup(sql_fn));
-    }
+  } else if (stream) {
+    stream_queue_push(sql_fn);
   }
-  m_close(sql_file);
   g_mutex_lock(dbt->rows_lock);
   dbt->rows+=num_rows;
   g_mutex_unlock(dbt->rows_lock);
+cleanup:
+  if (sql_file)
+    close_output_file(sql_file);
+  end_dictionary_samples(dbt, samples);
+  g_string_free(file_header, TRUE);
+  g_string_free(insert, TRUE);
   return num_rows;
 }
 
 /* Do actual data chunk reading/writing magic */
-guint64 write_table_data_into_file(MYSQL *conn, struct table_job * tj){
+guint64 write_table_data_into_file(struct thread_data *td, struct table_job * tj){
+  MYSQL *conn = td->thrconn;
   guint64 num_rows = 0;
 //  guint64 num_rows_st = 0;
   MYSQL_RES *result = NULL;
@@ -1456,9 +1457,9 @@ guint64 write_table_data_into_file(MYSQL *conn, struct table_job * tj){
 
   /* Poor man's data dump code */
   if (load_data)
-    num_rows = write_row_into_file_in_load_data_mode(conn, result, tj->dbt, tj->nchunk);
+    num_rows = write_row_into_file_in_load_data_mode(td, result, tj);
   else
-    num_rows=write_row_into_file_in_sql_mode(conn, result, tj->dbt, tj->nchunk, tj->where==NULL?1:2);
+    num_rows=write_row_into_file_in_sql_mode(td, result, tj);
   if (mysql_errno(conn)) {
     g_critical("Could not read data from %s.%s: %s", tj->database, tj->table,
                mysql_error(conn));
@@ -0,0 +1,459 @@
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+        Authors:    David Ducos, Percona (david dot ducos at percona dot com)
+*/
+#include <mysql.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <zlib.h>
+#ifdef WITH_ZSTD
+#include <zstd.h>
+#endif
+#include "common.h"
+#include "compression.h"
+#include "mydumper_start_dump.h"
+#include "mydumper_writer.h"
+#include "mydumper_stream.h"
+#include "mydumper_exec_command.h"
+#include "mydumper_io.h"
+
+/* Buffers each worker can have in flight besides the one it fills */
+#define OUTPUT_BUFFERS_PER_THREAD 3
+
+extern guint statement_size;
+extern guint errors;
+extern int compress_output;
+extern gboolean stream_diskless;
+extern gboolean exec_stdin;
+extern int build_empty_files;
+extern enum compression_method compression_method;
+extern gint compress_level;
+extern FILE *(*m_open)(const char *filename, const char *);
+extern int (*m_close)(void *file);
+extern struct output_backend *output_backend;
+
+guint num_write_threads = 0;
+
+/* The data files go to the stream, or to the command, as they are made */
+gboolean data_files_on_disk() {
+  return !stream_diskless && !exec_stdin;
+}
+
+/* A buffer of rows and the pieces that go before it. With -c it becomes a
+ * gzip member, or a zstd or lz4 frame, of its own, so the blocks of a file can be
+ * compressed at the same time and the file is still read as one stream. */
+struct write_block {
+  struct output_file *of;
+  guint64 number;
+  GString *prefix;
+  GString *data;
+  // Where data goes back once it is not needed, NULL to free it
+  GAsyncQueue *buffers;
+  GString *compressed;
+};
+
+GThread **writer_threads = NULL;
+GAsyncQueue *writer_queue = NULL;
+
+void release_block_data(struct write_block *wb) {
+  if (!wb->data)
+    return;
+  if (wb->buffers) {
+    g_string_set_size(wb->data, 0);
+    g_async_queue_push(wb->buffers, wb->data);
+  } else
+    g_string_free(wb->data, TRUE);
+  wb->data = NULL;
+}
+
+void free_write_block(struct write_block *wb) {
+  release_block_data(wb);
+  if (wb->prefix)
+    g_string_free(wb->prefix, TRUE);
+  if (wb->compressed)
+    g_string_free(wb->compressed, TRUE);
+  g_free(wb);
+}
+
+#ifdef WITH_ZSTD
+void compress_zstd_block(ZSTD_CCtx *cctx, struct write_block *wb) {
+  gsize bound = ZSTD_compressBound(wb->prefix->len +
+                                   (wb->data ? wb->data->len : 0));
+  ZSTD_inBuffer prefix = {wb->prefix->str, wb->prefix->len, 0};
+  ZSTD_inBuffer data = {wb->data ? wb->data->str : NULL,
+                        wb->data ? wb->data->len : 0, 0};
+  ZSTD_outBuffer out;
+  size_t remaining;
+
+  wb->compressed = g_string_sized_new(bound);
+  /* Every block is a frame, so the dictionary is set for each of them */
+  ZSTD_CCtx_refCDict(cctx, wb->of->dictionary);
+  out.dst = wb->compressed->str;
+  out.size = bound;
+  out.pos = 0;
+  do {
+    remaining = ZSTD_compressStream2(cctx, &out, &prefix, ZSTD_e_continue);
+  } while (!ZSTD_isError(remaining) && prefix.pos < prefix.size);
+  do {
+    remaining = ZSTD_compressStream2(cctx, &out, &data, ZSTD_e_end);
+  } while (!ZSTD_isError(remaining) && remaining);
+  if (ZSTD_isError(remaining)) {
+    g_critical("Could not compress data: %s", ZSTD_getErrorName(remaining));
+    ZSTD_CCtx_reset(cctx, ZSTD_reset_session_only);
+    g_atomic_int_set(&wb->of->failed, 1);
+    out.pos = 0;
+  }
+  g_string_set_size(wb->compressed, out.pos);
+}
+#endif
+
+void compress_gzip_block(struct write_block *wb) {
+  z_stream strm;
+  gsize bound;
+  int ret;
+
+  memset(&strm, 0, sizeof(strm));
+  /* 16 makes deflate write a gzip header */
+  deflateInit2(&strm, compress_level >= 0 ? compress_level : Z_DEFAULT_COMPRESSION,
+               Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY);
+  bound = deflateBound(&strm, wb->prefix->len +
+                                  (wb->data ? wb->data->len : 0));
+  wb->compressed = g_string_sized_new(bound);
+  strm.next_out = (Bytef *)wb->compressed->str;
+  strm.avail_out = bound;
+  strm.next_in = (Bytef *)wb->prefix->str;
+  strm.avail_in = wb->prefix->len;
+  ret = deflate(&strm, Z_NO_FLUSH);
+  if (ret == Z_OK) {
+    strm.next_in = wb->data ? (Bytef *)wb->data->str : NULL;
+    strm.avail_in = wb->data ? wb->data->len : 0;
+    ret = deflate(&strm, Z_FINISH);
+  }
+  if (ret != Z_STREAM_END) {
+    g_critical("Could not compress data: %s", strm.msg ? strm.msg : "");
+    g_atomic_int_set(&wb->of->failed, 1);
+    strm.total_out = 0;
+  }
+  g_string_set_size(wb->compressed, strm.total_out);
+  deflateEnd(&strm);
+}
+
+#ifdef WITH_LZ4
+void compress_lz4_block(void *cctx, struct write_block *wb) {
+  gsize data_len = wb->data ? wb->data->len : 0;
+  gsize bound = lz4_frame_bound(wb->prefix->len + data_len);
+  gsize len;
+  wb->compressed = g_string_sized_new(bound);
+  len = lz4_compress_frame(cctx, wb->compressed->str, bound, wb->prefix->str,
+                           wb->prefix->len, wb->data ? wb->data->str : NULL,
+                           data_len);
+  if (!len)
+    g_atomic_int_set(&wb->of->failed, 1);
+  g_string_set_size(wb->compressed, len);
+}
+#endif
+
+void compress_block(void *context, struct write_block *wb) {
+#ifdef WITH_ZSTD
+  if (compression_method == COMPRESSION_ZSTD) {
+    compress_zstd_block(context, wb);
+    return;
+  }
+#endif
+#ifdef WITH_LZ4
+  if (compression_method == COMPRESSION_LZ4) {
+    compress_lz4_block(context, wb);
+    return;
+  }
+#endif
+  (void)context;
+  compress_gzip_block(wb);
+}
+
+/* In --stream-diskless the block goes to the stream instead of the file */
+gboolean stream_write_block(struct write_block *wb) {
+  GString *data = wb->compressed;
+  if (data) {
+    wb->compressed = NULL;
+  } else {
+    data = g_string_sized_new(wb->prefix->len + (wb->data ? wb->data->len : 0));
+    g_string_append_len(data, wb->prefix->str, wb->prefix->len);
+    if (wb->data)
+      g_string_append_len(data, wb->data->str, wb->data->len);
+  }
+  if (data->len)
+    stream_block(wb->of->name, data);
+  else
+    g_string_free(data, TRUE);
+  return TRUE;
+}
+
+/* With --exec-stdin the command of the file is started with its first
+ * block, so no command is run for the files that end up empty */
+gboolean open_exec_output(struct output_file *of) {
+  int fd = start_exec_command(of->name, &of->exec_pid);
+  if (fd < 0) {
+    g_critical("Could not start the command for %s", of->name);
+    errors++;
+    return FALSE;
+  }
+  of->file = fdopen(fd, "w");
+  if (!of->file) {
+    g_critical("Could not pipe %s to its command", of->name);
+    close(fd);
+    errors++;
+    return FALSE;
+  }
+  return TRUE;
+}
+
+/* Files on disk go through the output backend, pipes with stdio */
+gboolean write_block_data(struct output_file *of, const gchar *data,
+                          gsize len) {
+  if (of->backend_file)
+    return output_backend->write(of->backend_file, data, len);
+  return write_raw(of->file, data, len);
+}
+
+gboolean write_block(struct write_block *wb) {
+  struct output_file *of = wb->of;
+  if (stream_diskless)
+    return stream_write_block(wb);
+  if (!of->backend_file && !of->file && !open_exec_output(of))
+    return FALSE;
+  if (wb->compressed)
+    return write_block_data(of, wb->compressed->str, wb->compressed->len);
+  return write_block_data(of, wb->prefix->str, wb->prefix->len) &&
+         (!wb->data || write_block_data(of, wb->data->str, wb->data->len));
+}
+
+/* Blocks are compressed in any order. The thread that finishes the block the
+ * file is waiting for writes it, and the ones that were ready after it,
+ * while the others go on compressing. */
+void write_ready_blocks(struct write_block *wb) {
+  struct output_file *of = wb->of;
+  g_mutex_lock(of->mutex);
+  g_hash_table_insert(of->ready_blocks, &wb->number, wb);
+  if (of->writing) {
+    g_mutex_unlock(of->mutex);
+    return;
+  }
+  of->writing = TRUE;
+  while ((wb = g_hash_table_lookup(of->ready_blocks, &of->written_blocks))) {
+    g_hash_table_remove(of->ready_blocks, &of->written_blocks);
+    g_mutex_unlock(of->mutex);
+    if (!g_atomic_int_get(&of->failed) && !write_block(wb))
+      g_atomic_int_set(&of->failed, 1);
+    free_write_block(wb);
+    g_mutex_lock(of->mutex);
+    of->written_blocks++;
+    g_cond_broadcast(of->cond);
+  }
+  of->writing = FALSE;
+  g_mutex_unlock(of->mutex);
+}
+
+void *writer_thread(gpointer data) {
+  struct write_block *wb;
+  void *context = NULL;
+  (void)data;
+#ifdef WITH_ZSTD
+  /* Blocks are already compressed in parallel, without zstd workers */
+  if (compression_method == COMPRESSION_ZSTD) {
+    context = ZSTD_createCCtx();
+    configure_zstd_context(context, FALSE);
+  }
+#endif
+#ifdef WITH_LZ4
+  if (compression_method == COMPRESSION_LZ4)
+    context = new_lz4_context();
+#endif
+  for (;;) {
+    wb = g_async_queue_pop(writer_queue);
+    if (!wb->of) {
+      g_free(wb);
+      break;
+    }
+    if (compress_output) {
+      compress_block(context, wb);
+      /* The worker can have its buffer back before the block is written */
+      release_block_data(wb);
+    }
+    write_ready_blocks(wb);
+  }
+#ifdef WITH_ZSTD
+  if (context && compression_method == COMPRESSION_ZSTD)
+    ZSTD_freeCCtx(context);
+#endif
+#ifdef WITH_LZ4
+  if (context && compression_method == COMPRESSION_LZ4)
+    free_lz4_context(context);
+#endif
+  return NULL;
+}
+
+void start_writer_threads() {
+  guint n;
+  if (!num_write_threads)
+    return;
+  start_output_backend();
+  writer_queue = g_async_queue_new();
+  writer_threads = g_new(GThread *, num_write_threads);
+  for (n = 0; n < num_write_threads; n++)
+    writer_threads[n] =
+        g_thread_create((GThreadFunc)writer_thread, NULL, TRUE, NULL);
+}
+
+/* Every file has been closed by then */
+void stop_writer_threads() {
+  guint n;
+  if (!num_write_threads)
+    return;
+  for (n = 0; n < num_write_threads; n++)
+    g_async_queue_push(writer_queue, g_new0(struct write_block, 1));
+  for (n = 0; n < num_write_threads; n++)
+    g_thread_join(writer_threads[n]);
+  g_async_queue_unref(writer_queue);
+  g_free(writer_threads);
+  writer_queue = NULL;
+  writer_threads = NULL;
+  stop_output_backend();
+}
+
+/* A worker blocks on its buffers when the writers are behind, which is what
+ * bounds the memory in flight */
+GAsyncQueue *new_output_buffers() {
+  GAsyncQueue *buffers = g_async_queue_new();
+  guint n;
+  if (num_write_threads)
+    for (n = 0; n < OUTPUT_BUFFERS_PER_THREAD; n++)
+      g_async_queue_push(buffers, g_string_sized_new(statement_size));
+  return buffers;
+}
+
+void free_output_buffers(GAsyncQueue *buffers) {
+  GString *buffer;
+  while ((buffer = g_async_queue_try_pop(buffers)))
+    g_string_free(buffer, TRUE);
+  g_async_queue_unref(buffers);
+}
+
+struct output_file *open_output_file(const char *filename, const char *mode,
+                                     void *dictionary) {
+  struct output_file *of = g_new0(struct output_file, 1);
+  of->blocks = num_write_threads > 0;
+  of->dictionary = dictionary;
+  if (stream_diskless)
+    of->name = g_path_get_basename(filename);
+  else if (exec_stdin)
+    of->name = g_strdup(filename);
+  else if (of->blocks)
+    of->backend_file = output_backend->open(filename, mode);
+  else if (dictionary)
+    of->file = zstd_open_with_dictionary(filename, mode, dictionary);
+  else
+    of->file = m_open(filename, mode);
+  if (!of->file && !of->name && !of->backend_file) {
+    g_critical("Could not open file: %s", filename);
+    exit(EXIT_FAILURE);
+  }
+  if (of->blocks) {
+    of->prefix = g_string_sized_new(0);
+    of->mutex = g_mutex_new();
+    of->cond = g_cond_new();
+    of->ready_blocks = g_hash_table_new(g_int64_hash, g_int64_equal);
+  }
+  return of;
+}
+
+void push_write_block(struct output_file *of, GString *data,
+                      GAsyncQueue *buffers) {
+  struct write_block *wb = g_new0(struct write_block, 1);
+  wb->of = of;
+  wb->number = of->next_block++;
+  wb->prefix = of->prefix;
+  wb->data = data;
+  wb->buffers = buffers;
+  of->prefix = g_string_sized_new(0);
+  g_async_queue_push(writer_queue, wb);
+}
+
+/* For the small pieces, like headers, which are copied */
+gboolean write_output(struct output_file *of, const gchar *data, gsize len) {
+  if (!of->blocks)
+    return write_buffer(of->file, data, len);
+  g_string_append_len(of->prefix, data, len);
+  return !g_atomic_int_get(&of->failed);
+}
+
+/* Writes the first length bytes of data and leaves it holding the bytes
+ * from keep_from on. The writers get the buffer itself, and the worker goes
+ * on with a free one, so only the kept bytes are copied. */
+gboolean write_output_buffer(struct output_file *of, GAsyncQueue *buffers,
+                             GString **data, gsize length, gsize keep_from) {
+  GString *full = *data;
+  gboolean ok = TRUE;
+  if (!of->blocks) {
+    ok = write_buffer(of->file, full->str, length);
+    g_string_erase(full, 0, keep_from);
+    return ok;
+  }
+  *data = g_async_queue_pop(buffers);
+  g_string_append_len(*data, full->str + keep_from, full->len - keep_from);
+  g_string_truncate(full, length);
+  push_write_block(of, full, buffers);
+  return !g_atomic_int_get(&of->failed);
+}
+
+/* Waits for every block of the file to be written, so the file is complete
+ * when it is streamed or removed */
+gboolean close_output_file(struct output_file *of) {
+  gboolean ok = TRUE;
+  if (!of->blocks) {
+    m_close(of->file);
+  } else {
+    if (of->prefix->len)
+      push_write_block(of, NULL, NULL);
+    g_string_free(of->prefix, TRUE);
+    g_mutex_lock(of->mutex);
+    while (of->written_blocks < of->next_block)
+      g_cond_wait(of->cond, of->mutex);
+    g_mutex_unlock(of->mutex);
+    if (exec_stdin && !of->exec_pid && build_empty_files &&
+        !open_exec_output(of))
+      g_atomic_int_set(&of->failed, 1);
+    if (of->backend_file) {
+      if (!output_backend->close(of->backend_file))
+        g_atomic_int_set(&of->failed, 1);
+    } else if (of->file)
+      fclose(of->file);
+    else if (stream_diskless && (of->next_block || build_empty_files))
+      stream_end_of_file(of->name);
+    if (of->exec_pid && !finish_exec_command(of->exec_pid, of->name))
+      g_atomic_int_set(&of->failed, 1);
+    g_hash_table_destroy(of->ready_blocks);
+    g_mutex_free(of->mutex);
+    g_cond_free(of->cond);
+  }
+  ok = !g_atomic_int_get(&of->failed);
+  g_free(of->name);
+  g_free(of);
+  return ok;
+}
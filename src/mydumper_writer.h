@@ -0,0 +1,53 @@
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+        Authors:    David Ducos, Percona (david dot ducos at percona dot com)
+*/
+
+// A data file being written. With --write-threads its blocks are compressed
+// by any of the writer threads and written in the order they were made.
+struct output_file {
+  FILE *file;
+  // The file on disk with --write-threads, opened by the output backend
+  void *backend_file;
+  // The name in the stream, when the file is not written with
+  // --stream-diskless, or the one the command gets with --exec-stdin
+  gchar *name;
+  // The command the file is piped to with --exec-stdin, 0 until it starts
+  GPid exec_pid;
+  // The zstd dictionary of the table, if it has one
+  void *dictionary;
+  gboolean blocks;
+  // Small pieces, like headers, that lead the next block
+  GString *prefix;
+  GMutex *mutex;
+  GCond *cond;
+  guint64 next_block;
+  guint64 written_blocks;
+  GHashTable *ready_blocks;
+  gboolean writing;
+  gint failed;
+};
+
+gboolean data_files_on_disk();
+void start_writer_threads();
+void stop_writer_threads();
+GAsyncQueue *new_output_buffers();
+void free_output_buffers(GAsyncQueue *buffers);
+struct output_file *open_output_file(const char *filename, const char *mode,
+                                     void *dictionary);
+gboolean write_output(struct output_file *of, const gchar *data, gsize len);
+gboolean write_output_buffer(struct output_file *of, GAsyncQueue *buffers,
+                             GString **data, gsize length, gsize keep_from);
+gboolean close_output_file(struct output_file *of);
@@ -34,13 +34,10 @@
 #include <stdlib.h>
 #include <stdarg.h>
 #include <errno.h>
-#ifdef ZWRAP_USE_ZSTD
-#include "../zstd/zstd_zlibwrapper.h"
-#else
 #include <zlib.h>
-#endif
 #include "config.h"
 #include "common.h"
+#include "compression.h"
 #include "myloader_stream.h"
 
 #include "connection.h"
@@ -61,6 +58,7 @@
 #include "myloader_restore_job.h"
 guint commit_count = 1000;
 gchar *input_directory = NULL;
+gchar **input_directories = NULL;
 gchar *directory = NULL;
 gchar *pwd=NULL;
 gboolean overwrite_tables = FALSE;
@@ -173,19 +171,26 @@ GHashTable * myloader_initialize_hash_of_session_variables(){
 void create_database(struct thread_data *td, gchar *database) {
   gchar *query = NULL;
 
-  const gchar *filename =
-      g_strdup_printf("%s-schema-create.sql", database);
-  const gchar *filenamegz =
-      g_strdup_printf("%s-schema-create.sql%s", database, compress_extension);
-  const gchar *filepath = g_strdup_printf("%s/%s-schema-create.sql",
-                                          directory, database);
-  const gchar *filepathgz = g_strdup_printf("%s/%s-schema-create.sql%s",
-                                            directory, database, compress_extension);
+  gchar *filename = NULL;
+  gchar *filepath = NULL;
+  guint method;
+
+  /* The file can be compressed with any of the methods */
+  for (method = COMPRESSION_NONE; method <= COMPRESSION_LZ4; method++) {
+    filename = g_strdup_printf("%s-schema-create.sql%s", database,
+                               get_compression_extension(method));
+    filepath = g_build_filename(directory, filename, NULL);
+    if (g_file_test(filepath, G_FILE_TEST_EXISTS))
+      break;
+    g_free(filename);
+    g_free(filepath);
+    filename = NULL;
+  }
 
-  if (g_file_test(filepath, G_FILE_TEST_EXISTS)) {
+  if (filename) {
     restore_data_from_file(td, database, NULL, filename, TRUE);
-  } else if (g_file_test(filepathgz, G_FILE_TEST_EXISTS)) {
-    restore_data_from_file(td, database, NULL, filenamegz, TRUE);
+    g_free(filename);
+    g_free(filepath);
   } else {
     query = g_strdup_printf("CREATE DATABASE IF NOT EXISTS `%s`", database);
     if (mysql_query(td->thrconn, query)){
@@ -243,11 +248,6 @@ int main(int argc, char *argv[]) {
 
   set_verbose(verbose);
 
-#ifdef ZWRAP_USE_ZSTD
-  compress_extension = g_strdup(".zst");
-#else
-  compress_extension = g_strdup(".gz");
-#endif
   if (set_names_str){
     gchar *tmp_str=g_strdup_printf("/*!40101 SET NAMES %s*/",set_names_str);
     set_names_str=tmp_str;
@@ -294,6 +294,9 @@ int main(int argc, char *argv[]) {
       exit(EXIT_FAILURE);
     }
   } else {
+    // The data files of a dump striped by mydumper are in the rest
+    input_directories=g_strsplit(input_directory, ",", 0);
+    input_directory=input_directories[0];
     directory=g_strdup_printf("%s/%s", g_str_has_prefix(input_directory,"/")?"":current_dir, input_directory);
     if (!g_file_test(input_directory,G_FILE_TEST_IS_DIR)){
       if (stream){
@@ -310,6 +313,7 @@ int main(int argc, char *argv[]) {
         exit(EXIT_FAILURE);
       }
       initialize_directory();
+      initialize_data_directories(input_directories + 1, current_dir);
     }
   }
   g_free(current_dir);
@@ -319,6 +323,7 @@ int main(int argc, char *argv[]) {
     read_tables_skiplist(tables_skiplist_file, &errors);
   initialize_process(&conf);
   initialize_common();
+  initialize_compression();
   initialize_regex();
   GError *serror;
   GThread *sthread =
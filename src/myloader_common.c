@@ -20,12 +20,9 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#ifdef ZWRAP_USE_ZSTD
-#include "../zstd/zstd_zlibwrapper.h"
-#else
 #include <zlib.h>
-#endif
 #include "common.h"
+#include "compression.h"
 #include "myloader_stream.h"
 #include "myloader_common.h"
 #include "myloader_process.h"
@@ -37,7 +34,6 @@
 #include "regex.h"
 #include <errno.h>
 
-extern gchar *compress_extension;
 extern gchar *db;
 extern gboolean no_delete;
 extern gboolean stream;
@@ -57,8 +53,9 @@ void initialize_common(){
 }
 
 gboolean m_filename_has_suffix(gchar const *str, gchar const *suffix){
-  if (g_str_has_suffix(str, compress_extension)){
-    return g_strstr_len(&(str[strlen(str)-strlen(compress_extension)-strlen(suffix)]), strlen(str)-strlen(compress_extension),suffix) != NULL; 
+  const gchar *extension = get_compression_extension(get_compression_method_for(str));
+  if (*extension){
+    return g_strstr_len(&(str[strlen(str)-strlen(extension)-strlen(suffix)]), strlen(str)-strlen(extension),suffix) != NULL; 
   }
   return g_str_has_suffix(str,suffix);
 }
@@ -130,6 +127,8 @@ enum file_type get_file_type (const char * filename){
     return SCHEMA_TABLE;
   } else if (m_filename_has_suffix(filename, "-metadata")) {
     return METADATA_TABLE;
+  } else if (g_str_has_suffix(filename, "-dictionary")) {
+    return DICTIONARY;
   } else if ( strcmp(filename, "metadata") == 0 ){
     return METADATA_GLOBAL;
   } else if ( strcmp(filename, "all-schema-create-tablespace.sql") == 0 ){
@@ -176,8 +175,8 @@ gboolean read_data(FILE *file, gboolean is_compressed, GString *data,
         }
       }
     } else {
-      if (!gzgets((gzFile)file, buffer, 256)) {
-        if (gzeof((gzFile)file)) {
+      if (!compressed_gets(file, buffer, 256)) {
+        if (compressed_eof(file)) {
           *eof = TRUE;
           buffer[0] = '\0';
         } else {
@@ -313,11 +312,11 @@ void checksum_filename(const gchar *filename, MYSQL *conn, const gchar *suffix,
   gboolean is_compressed = FALSE;
   gchar *path = g_build_filename(directory, filename, NULL);
 
-  if (!g_str_has_suffix(path, compress_extension)) {
+  if (!is_compressed_filename(path)) {
     infile = g_fopen(path, "r");
     is_compressed = FALSE;
   } else {
-    infile = (void *)gzopen(path, "r");
+    infile = open_compressed_file(path);
     is_compressed=TRUE;
   }
 
@@ -327,7 +326,7 @@ void checksum_filename(const gchar *filename, MYSQL *conn, const gchar *suffix,
     return;
   }
 
-  char * cs= !is_compressed ? fgets(checksum, 256, infile) :gzgets((gzFile)infile, checksum, 256);
+  char * cs= !is_compressed ? fgets(checksum, 256, infile) :compressed_gets(infile, checksum, 256);
   if (cs != NULL) {
     if(g_strcasecmp(checksum, row) != 0) {
       if (real_table != NULL)
@@ -350,7 +349,7 @@ void checksum_filename(const gchar *filename, MYSQL *conn, const gchar *suffix,
   if (!is_compressed) {
     fclose(infile);
   } else {
-    gzclose((gzFile)infile);
+    close_compressed_file(infile);
   }
 }
 
@@ -384,11 +383,11 @@ void checksum_databases(struct thread_data *td) {
 }
 
 void ml_open(FILE **infile, const gchar *filename, gboolean *is_compressed){
-  if (!g_str_has_suffix(filename, compress_extension)) {
+  if (!is_compressed_filename(filename)) {
     *infile = g_fopen(filename, "r");
     *is_compressed = FALSE;
   } else {
-    *infile = (void *)gzopen(filename, "r");
+    *infile = open_compressed_file(filename);
     *is_compressed = TRUE;
   }
 }
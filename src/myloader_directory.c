@@ -22,11 +22,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#ifdef ZWRAP_USE_ZSTD
-#include "../zstd/zstd_zlibwrapper.h"
-#else
 #include <zlib.h>
-#endif
 #include "myloader_stream.h"
 #include "common.h"
 #include "myloader.h"
@@ -56,6 +52,51 @@ void initialize_directory(){
   data_filename_queue_completed = g_async_queue_new();
 }
 
+/* The other directories mydumper striped the data files across, and the
+ * one of each file found in them */
+static GPtrArray *data_directories = NULL;
+static GHashTable *data_file_directories = NULL;
+
+gchar *build_absolute_directory(const gchar *path, const gchar *current_dir){
+  return g_path_is_absolute(path) ? g_strdup(path) : g_build_filename(current_dir, path, NULL);
+}
+
+/* They are the ones after the first in --directory, or else the ones the
+ * metadata lists, where the first is directory itself. Relative paths are
+ * taken from current_dir. */
+void initialize_data_directories(gchar **directories, const gchar *current_dir){
+  gchar *path = g_build_filename(directory, "metadata", NULL);
+  gchar *metadata = NULL, **lines = NULL, **line = NULL;
+  gboolean listed = FALSE, first = TRUE;
+  data_directories = g_ptr_array_new();
+  data_file_directories = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+  if (*directories){
+    for (; *directories; directories++)
+      g_ptr_array_add(data_directories, build_absolute_directory(*directories, current_dir));
+  } else if (g_file_get_contents(path, &metadata, NULL, NULL)){
+    lines = g_strsplit(metadata, "\n", 0);
+    for (line = lines; *line; line++){
+      if (!listed){
+        listed = !strcmp(*line, "Output directories:");
+        continue;
+      }
+      if (**line != '\t')
+        break;
+      if (!first)
+        g_ptr_array_add(data_directories, build_absolute_directory(*line + 1, current_dir));
+      first = FALSE;
+    }
+    g_strfreev(lines);
+    g_free(metadata);
+  }
+  g_free(path);
+}
+
+const gchar *get_data_file_directory(const gchar *filename){
+  const gchar *d = data_file_directories ? g_hash_table_lookup(data_file_directories, filename) : NULL;
+  return d ? d : directory;
+}
+
 gint compare_by_time(gconstpointer a, gconstpointer b){
   return
     g_date_time_difference(((struct db_table *)a)->finish_time,((struct db_table *)a)->start_time) >
@@ -101,6 +142,9 @@ gboolean append_filename_to_list (
             break;
           case METADATA_GLOBAL:
             break;
+          case DICTIONARY:
+            process_dictionary_filename(filename);
+            break;
           case METADATA_TABLE:
             // TODO: we need to process this info
             *metadata_list=g_list_append(*metadata_list,g_strdup(filename));
@@ -187,6 +231,31 @@ void load_directory_information(struct configuration *conf) {
  
   g_dir_close(dir);
 
+  // Only data files are striped, a resume file already lists them
+  guint d;
+  const gchar *data_directory = NULL;
+  for (d = 0; data_directories && d < data_directories->len; d++){
+    data_directory = g_ptr_array_index(data_directories, d);
+    dir = g_dir_open(data_directory, 0, &error);
+    if (error) {
+      g_critical("cannot open directory %s, %s\n", data_directory, error->message);
+      g_error_free(error);
+      error = NULL;
+      errors++;
+      continue;
+    }
+    while ((filename = g_dir_read_name(dir))){
+      if (get_file_type(filename) != DATA){
+        g_warning("File ignored: %s/%s", data_directory, filename);
+        continue;
+      }
+      g_hash_table_insert(data_file_directories, g_strdup(filename), (gpointer)data_directory);
+      if (cont)
+        append_filename_to_list(&schema_create_list,&create_table_list,&metadata_list,&data_files_list,&view_list,&trigger_list,&post_list,&(conf->checksum_list),filename,FALSE);
+    }
+    g_dir_close(dir);
+  }
+
   gchar *f = NULL;
   g_debug("Processing database files");
   // CREATE DATABASE
@@ -16,5 +16,7 @@
 
 */
 void initialize_directory();
+void initialize_data_directories(gchar **directories, const gchar *current_dir);
+const gchar *get_data_file_directory(const gchar *filename);
 void restore_from_directory(struct configuration *conf);
 void *process_directory_queue(struct thread_data * td);
@@ -21,12 +21,9 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
-#ifdef ZWRAP_USE_ZSTD
-#include "../zstd/zstd_zlibwrapper.h"
-#else
 #include <zlib.h>
-#endif
 #include "common.h"
+#include "compression.h"
 #include "myloader_stream.h"
 #include "myloader_common.h"
 #include "myloader_process.h"
@@ -34,7 +31,6 @@
 #include "myloader_control_job.h"
 #include "myloader_restore_job.h"
 
-extern gchar *compress_extension;
 extern gchar *db;
 extern gboolean stream;
 extern guint max_threads_per_table; 
@@ -144,11 +140,11 @@ void load_schema(struct db_table *dbt, gchar *filename){
   g_string_set_size(data,0);
   g_string_set_size(create_table_statement,0);
   guint line=0;
-  if (!g_str_has_suffix(filename, compress_extension)) {
+  if (!is_compressed_filename(filename)) {
     infile = g_fopen(filename, "r");
     is_compressed = FALSE;
   } else {
-    infile = (void *)gzopen(filename, "r");
+    infile = open_compressed_file(filename);
     is_compressed = TRUE;
   }
   if (!infile) {
@@ -230,7 +226,7 @@ void load_schema(struct db_table *dbt, gchar *filename){
   if (!is_compressed) {
     fclose(infile);
   } else {
-    gzclose((gzFile)infile);
+    close_compressed_file(infile);
   }
   if (stream && no_delete == FALSE){
     m_remove(NULL,filename);
@@ -243,9 +239,7 @@ void load_schema(struct db_table *dbt, gchar *filename){
 
 void get_database_table_part_name_from_filename(const gchar *filename, gchar **database, gchar **table, guint *part, guint *sub_part){
   guint l = strlen(filename)-4;
-  if (g_str_has_suffix(filename, compress_extension)) {
-    l-=strlen(compress_extension);
-  }
+  l-=strlen(get_compression_extension(get_compression_method_for(filename)));
   gchar *f=g_strndup(filename, l);
   gchar **split_db_tbl = g_strsplit(f, ".", -1);
   g_free(f);
@@ -324,7 +318,7 @@ gchar * get_database_name_from_content(const gchar *filename){
   if (!is_compressed) {
     fclose(infile);
   } else {
-    gzclose((gzFile)infile);
+    close_compressed_file(infile);
   }
   return real_database;
 }
@@ -381,6 +375,15 @@ void process_table_filename(char * filename){
   g_free(filename);
 }
 
+/* The dictionary is read before the data files of the table, which name it
+ * in their zstd frames */
+void process_dictionary_filename(const gchar *filename){
+  gchar *path = g_build_filename(directory, filename, NULL);
+  if (!register_zstd_dictionary(path))
+    errors++;
+  g_free(path);
+}
+
 void process_metadata_filename(char * filename){
   gchar *db_name, *table_name;
   get_database_table_name_from_filename(filename,"-metadata",&db_name,&table_name);
@@ -392,11 +395,11 @@ void process_metadata_filename(char * filename){
   gboolean is_compressed = FALSE;
   gchar *path = g_build_filename(directory, filename, NULL);
   char metadata_val[256];
-  if (!g_str_has_suffix(path, compress_extension)) {
+  if (!is_compressed_filename(path)) {
     infile = g_fopen(path, "r");
     is_compressed = FALSE;
   } else {
-    infile = (void *)gzopen(path, "r");
+    infile = open_compressed_file(path);
     is_compressed = TRUE;
   }
 
@@ -406,12 +409,12 @@ void process_metadata_filename(char * filename){
     return;
   }
 
-  char * cs= !is_compressed ? fgets(metadata_val, 256, infile) :gzgets((gzFile)infile, metadata_val, 256);
+  char * cs= !is_compressed ? fgets(metadata_val, 256, infile) :compressed_gets(infile, metadata_val, 256);
   append_new_db_table(NULL, db_name, table_name,g_ascii_strtoull(cs, NULL, 10),conf->table_hash,NULL);
   if (!is_compressed) {
     fclose(infile);
   } else {
-    gzclose((gzFile)infile);
+    close_compressed_file(infile);
   }
 }
 
@@ -20,6 +20,7 @@ void process_tablespace_filename( char * filename) ;
 void process_database_filename(char * filename, const char *object);
 void process_table_filename(char * filename);
 void process_metadata_filename( char * filename);
+void process_dictionary_filename(const gchar *filename);
 void process_schema_filename(gchar *filename, const char * object);
 void process_data_filename(char * filename);
 //struct job * new_job (enum job_type type, void *job_data, char *use_database);
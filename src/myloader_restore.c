@@ -19,20 +19,17 @@
 #include <glib/gstdio.h>
 #include <stdio.h>
 #include <string.h>
-#ifdef ZWRAP_USE_ZSTD
-#include "../zstd/zstd_zlibwrapper.h"
-#else
 #include <zlib.h>
-#endif
 #include "common.h"
+#include "compression.h"
 #include <errno.h>
 #include "myloader.h"
 #include "myloader_jobs_manager.h"
 #include "myloader_common.h"
+#include "myloader_directory.h"
 extern guint errors;
 extern guint commit_count;
 extern gchar *directory;
-extern gchar *compress_extension;
 extern guint rows;
 
 gboolean skip_definer = FALSE;
@@ -141,7 +138,7 @@ int restore_data_from_file(struct thread_data *td, char *database, char *table,
   guint query_counter = 0;
   GString *data = g_string_sized_new(256);
   guint line=0,preline=0;
-  gchar *path = g_build_filename(directory, filename, NULL);
+  gchar *path = g_build_filename(get_data_file_directory(filename), filename, NULL);
   ml_open(&infile,path,&is_compressed);
 
 /*  if (!g_str_has_suffix(path, compress_extension)) {
@@ -193,10 +190,10 @@ int restore_data_from_file(struct thread_data *td, char *database, char *table,
   if (!is_compressed) {
     fclose(infile);
   } else {
-    gzclose((gzFile)infile);
+    close_compressed_file(infile);
   }
 
-  m_remove(directory,filename);
+  m_remove((gchar *)get_data_file_directory(filename),filename);
   g_free(path);
   return r;
 }
@@ -20,12 +20,11 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#ifdef ZWRAP_USE_ZSTD
-#include "../zstd/zstd_zlibwrapper.h"
-#else
 #include <zlib.h>
-#endif
+#include <fcntl.h>
+#include <unistd.h>
 #include "common.h"
+#include "stream_format.h"
 #include "myloader_common.h"
 #include "myloader_process.h"
 #include "myloader_jobs_manager.h"
@@ -33,7 +32,6 @@
 #include "myloader_restore_job.h"
 #include "myloader_control_job.h"
 
-extern gchar *compress_extension;
 extern gchar *db;
 extern gchar *directory;
 extern gchar *source_db;
@@ -45,6 +43,7 @@ extern GAsyncQueue *stream_queue;
 extern int (*m_close)(void *file);
 extern int (*m_write)(FILE * file, const char * buff, int len);
 extern guint total_data_sql_files;
+extern guint errors;
 
 GAsyncQueue *intermidiate_queue = NULL;
 GThread *stream_thread = NULL;
@@ -106,6 +105,10 @@ enum file_type process_filename(char *filename){
         break;
       case METADATA_GLOBAL:
         break;
+      case DICTIONARY:
+        process_dictionary_filename(filename);
+        g_free(filename);
+        break;
       case METADATA_TABLE:
         stream_conf->metadata_list=g_list_insert(stream_conf->metadata_list,filename,-1);
         process_metadata_filename(filename);
@@ -142,13 +145,17 @@ gboolean has_mydumper_suffix(gchar *line){
     g_str_has_suffix(line,".dat") ||
     g_str_has_suffix(line,".dat.gz") ||
     g_str_has_suffix(line,".dat.zst") ||
+    g_str_has_suffix(line,".dat.lz4") ||
     g_str_has_suffix(line,".sql") || 
     g_str_has_suffix(line,".sql.gz") || 
     g_str_has_suffix(line,".sql.zst") ||
+    g_str_has_suffix(line,".sql.lz4") ||
     g_str_has_suffix(line,"metadata") || 
+    g_str_has_suffix(line,"-dictionary") || 
     g_str_has_suffix(line,"-checksum") || 
     g_str_has_suffix(line,"-checksum.gz") ||
-    g_str_has_suffix(line,"-checksum.zst");
+    g_str_has_suffix(line,"-checksum.zst") ||
+    g_str_has_suffix(line,"-checksum.lz4");
 }
 
 void process_stream_filename(gchar * filename){
@@ -157,7 +164,8 @@ void process_stream_filename(gchar * filename){
       current_ft != SCHEMA_TRIGGER &&
       current_ft != SCHEMA_POST &&
       current_ft != CHECKSUM &&
-      current_ft != METADATA_TABLE )
+      current_ft != METADATA_TABLE &&
+      current_ft != DICTIONARY )
   g_async_queue_push(stream_queue, GINT_TO_POINTER(current_ft));
 }
 
@@ -288,6 +296,205 @@ void flush(char *buffer, int from, int to, FILE *file){
       g_critical("error on writing");
 }
 
+/* The blocks are written by several threads, at the offset they have in
+ * their file, while the next ones are read */
+#define STREAM_DECODE_THREADS 4
+#define STREAM_DECODE_MEMORY_LIMIT (64 * STREAM_BUFFER_SIZE)
+
+struct stream_file {
+  gchar *name;
+  int fd;
+  guint64 size;
+  guint pending;
+};
+
+struct stream_data_block {
+  struct stream_file *file;
+  guint64 offset;
+  gchar *data;
+  guint32 length;
+  guint32 checksum;
+};
+
+GAsyncQueue *stream_decode_queue = NULL;
+static GMutex *stream_decode_mutex = NULL;
+static GCond *stream_decode_cond = NULL;
+static gsize stream_decode_memory = 0;
+/* The closed files, in the order they were closed in the stream, which is
+ * the order they are processed in */
+static GQueue *closed_stream_files = NULL;
+
+/* Called with stream_decode_mutex held */
+void push_complete_stream_files(){
+  struct stream_file *sf;
+  while ((sf = g_queue_peek_head(closed_stream_files)) && !sf->pending){
+    g_queue_pop_head(closed_stream_files);
+    if (close(sf->fd)){
+      g_critical("error on closing %s", sf->name);
+      errors++;
+    }
+    g_async_queue_push(intermidiate_queue, sf->name);
+    g_free(sf);
+  }
+}
+
+void *process_stream_decode(){
+  struct stream_data_block *b;
+  gsize written;
+  ssize_t r;
+  for (;;){
+    b = g_async_queue_pop(stream_decode_queue);
+    if (!b->file){
+      g_free(b);
+      break;
+    }
+    if (crc32c(0, b->data, b->length) != b->checksum){
+      g_critical("Stream is corrupted, wrong checksum in a block of %s", b->file->name);
+      exit(EXIT_FAILURE);
+    }
+    for (written = 0; written < b->length; written += r){
+      r = pwrite(b->file->fd, b->data + written, b->length - written, b->offset + written);
+      if (r <= 0){
+        g_critical("error on writing %s", b->file->name);
+        exit(EXIT_FAILURE);
+      }
+    }
+    g_free(b->data);
+    g_mutex_lock(stream_decode_mutex);
+    stream_decode_memory -= b->length;
+    g_cond_broadcast(stream_decode_cond);
+    b->file->pending--;
+    push_complete_stream_files();
+    g_mutex_unlock(stream_decode_mutex);
+    g_free(b);
+  }
+  return NULL;
+}
+
+gboolean read_stream_data(gchar *data, guint32 len){
+  return fread(data, 1, len, stdin) == len;
+}
+
+/* The stream is split by the lengths in the block headers, and the blocks
+ * are checked and written by the decode threads. A file is processed when
+ * it is closed and all its blocks are written. */
+void read_stream_blocks(const guchar *stream_header){
+  GHashTable *files = g_hash_table_new(g_direct_hash, g_direct_equal);
+  GThread *decode_threads[STREAM_DECODE_THREADS];
+  GHashTableIter iter;
+  guchar header[STREAM_HEADER_SIZE > STREAM_BLOCK_HEADER_SIZE ? STREAM_HEADER_SIZE : STREAM_BLOCK_HEADER_SIZE];
+  struct stream_block_header h;
+  struct stream_file *sf = NULL;
+  struct stream_data_block *b = NULL;
+  gchar *data = NULL, *real_filename = NULL;
+  guint32 version = 0;
+  gboolean end = FALSE;
+  guint i;
+
+  memcpy(header, stream_header, STREAM_MAGIC_LEN);
+  if (fread(header + STREAM_MAGIC_LEN, 1, STREAM_HEADER_SIZE - STREAM_MAGIC_LEN, stdin) != STREAM_HEADER_SIZE - STREAM_MAGIC_LEN ||
+      !decode_stream_header(header, &version)){
+    g_critical("Stream is corrupted, the stream header is not complete");
+    exit(EXIT_FAILURE);
+  }
+  if (version > STREAM_VERSION){
+    g_critical("Stream version %u is not supported, the latest is %u", version, STREAM_VERSION);
+    exit(EXIT_FAILURE);
+  }
+  initialize_crc32c();
+  stream_decode_queue = g_async_queue_new();
+  stream_decode_mutex = g_mutex_new();
+  stream_decode_cond = g_cond_new();
+  closed_stream_files = g_queue_new();
+  for (i = 0; i < STREAM_DECODE_THREADS; i++)
+    decode_threads[i] = g_thread_create((GThreadFunc)process_stream_decode, NULL, TRUE, NULL);
+
+  while (!end){
+    if (fread(header, 1, STREAM_BLOCK_HEADER_SIZE, stdin) != STREAM_BLOCK_HEADER_SIZE){
+      g_critical("Stream ended before its end block");
+      errors++;
+      break;
+    }
+    if (!decode_stream_block_header(header, &h)){
+      g_critical("Stream is corrupted, wrong block header");
+      exit(EXIT_FAILURE);
+    }
+    sf = g_hash_table_lookup(files, GUINT_TO_POINTER(h.file_id));
+    if (h.type != STREAM_END && (h.type == STREAM_FILE_OPEN) == (sf != NULL)){
+      g_critical("Stream is corrupted, unexpected block of file %u", h.file_id);
+      exit(EXIT_FAILURE);
+    }
+    data = h.length ? g_malloc(h.length) : NULL;
+    if (h.length && !read_stream_data(data, h.length)){
+      g_critical("Stream ended in the middle of a block of file %u", h.file_id);
+      exit(EXIT_FAILURE);
+    }
+    switch (h.type){
+      case STREAM_FILE_OPEN:
+        if (!h.length || crc32c(0, data, h.length) != h.checksum || memchr(data, '/', h.length) || memchr(data, '\0', h.length)){
+          g_critical("Stream is corrupted, wrong name of file %u", h.file_id);
+          exit(EXIT_FAILURE);
+        }
+        sf = g_new0(struct stream_file, 1);
+        sf->name = g_strndup(data, h.length);
+        real_filename = g_build_filename(directory, sf->name, NULL);
+        sf->fd = g_open(real_filename, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+        if (sf->fd < 0){
+          g_critical("cannot create file %s", real_filename);
+          exit(EXIT_FAILURE);
+        }
+        g_free(real_filename);
+        g_hash_table_insert(files, GUINT_TO_POINTER(h.file_id), sf);
+        g_free(data);
+        break;
+      case STREAM_FILE_DATA:
+        if (!h.length)
+          break;
+        b = g_new(struct stream_data_block, 1);
+        b->file = sf;
+        b->offset = sf->size;
+        b->data = data;
+        b->length = h.length;
+        b->checksum = h.checksum;
+        sf->size += h.length;
+        g_mutex_lock(stream_decode_mutex);
+        while (stream_decode_memory && stream_decode_memory + h.length > STREAM_DECODE_MEMORY_LIMIT)
+          g_cond_wait(stream_decode_cond, stream_decode_mutex);
+        stream_decode_memory += h.length;
+        sf->pending++;
+        g_mutex_unlock(stream_decode_mutex);
+        g_async_queue_push(stream_decode_queue, b);
+        break;
+      case STREAM_FILE_CLOSE:
+        g_free(data);
+        g_hash_table_remove(files, GUINT_TO_POINTER(h.file_id));
+        g_mutex_lock(stream_decode_mutex);
+        g_queue_push_tail(closed_stream_files, sf);
+        push_complete_stream_files();
+        g_mutex_unlock(stream_decode_mutex);
+        break;
+      case STREAM_END:
+        g_free(data);
+        end = TRUE;
+        break;
+    }
+  }
+  for (i = 0; i < STREAM_DECODE_THREADS; i++)
+    g_async_queue_push(stream_decode_queue, g_new0(struct stream_data_block, 1));
+  for (i = 0; i < STREAM_DECODE_THREADS; i++)
+    g_thread_join(decode_threads[i]);
+  g_hash_table_iter_init(&iter, files);
+  while (g_hash_table_iter_next(&iter, NULL, (gpointer *) &sf)){
+    g_critical("Stream ended before %s was complete", sf->name);
+    close(sf->fd);
+    g_free(sf->name);
+    g_free(sf);
+    errors++;
+  }
+  g_hash_table_destroy(files);
+  g_queue_free(closed_stream_files);
+}
+
 void *process_stream(){
   char * filename=NULL,*real_filename=NULL,* previous_filename=NULL;
   char buffer[STREAM_BUFFER_SIZE];
@@ -299,7 +506,12 @@ void *process_stream(){
   for(i=0;i<STREAM_BUFFER_SIZE;i++){
     buffer[i]='\0';
   }
-  do {
+  diff=fread(buffer, 1, STREAM_MAGIC_LEN, stdin);
+  if (diff == STREAM_MAGIC_LEN && !memcmp(buffer, STREAM_MAGIC, STREAM_MAGIC_LEN)){
+    read_stream_blocks((guchar *)buffer);
+    eof=TRUE;
+  }
+  while (eof == FALSE) {
 read_more:    buffer_len=read_stream_line(&(buffer[diff]),&eof,file,STREAM_BUFFER_SIZE-1-diff)+diff;
 
     next_line_from=0;
@@ -348,7 +560,7 @@ read_more:    buffer_len=read_stream_line(&(buffer[diff]),&eof,file,STREAM_BUFFE
         next_line_from=last_pos;
       }
     }
-  } while (eof == FALSE);
+  }
   if (file) 
     m_close(file);
   if (filename)
@@ -0,0 +1,130 @@
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Authors:        David Ducos, Percona (david dot ducos at percona dot com)
+*/
+#include <glib.h>
+#include <string.h>
+#include "stream_format.h"
+
+#define CRC32C_POLYNOMIAL 0x82F63B78
+
+static guint32 crc32c_table[8][256];
+static gboolean crc32c_sse42 = FALSE;
+
+/* The tables of the slice-by-8 version, for the CPUs without the crc32
+ * instruction */
+void initialize_crc32c() {
+  guint32 i, j, crc;
+  for (i = 0; i < 256; i++) {
+    crc = i;
+    for (j = 0; j < 8; j++)
+      crc = crc & 1 ? (crc >> 1) ^ CRC32C_POLYNOMIAL : crc >> 1;
+    crc32c_table[0][i] = crc;
+  }
+  for (i = 0; i < 256; i++)
+    for (j = 1; j < 8; j++)
+      crc32c_table[j][i] = (crc32c_table[j - 1][i] >> 8) ^
+                           crc32c_table[0][crc32c_table[j - 1][i] & 0xff];
+#if defined(__GNUC__) && defined(__x86_64__)
+  crc32c_sse42 = __builtin_cpu_supports("sse4.2");
+#endif
+}
+
+static guint32 crc32c_sw(guint32 crc, const guchar *p, gsize len) {
+  while (len >= 8) {
+    crc ^= p[0] | p[1] << 8 | p[2] << 16 | (guint32)p[3] << 24;
+    crc = crc32c_table[7][crc & 0xff] ^ crc32c_table[6][(crc >> 8) & 0xff] ^
+          crc32c_table[5][(crc >> 16) & 0xff] ^ crc32c_table[4][crc >> 24] ^
+          crc32c_table[3][p[4]] ^ crc32c_table[2][p[5]] ^
+          crc32c_table[1][p[6]] ^ crc32c_table[0][p[7]];
+    p += 8;
+    len -= 8;
+  }
+  while (len--)
+    crc = (crc >> 8) ^ crc32c_table[0][(crc ^ *p++) & 0xff];
+  return crc;
+}
+
+#if defined(__GNUC__) && defined(__x86_64__)
+__attribute__((target("sse4.2")))
+static guint32 crc32c_hw(guint32 crc, const guchar *p, gsize len) {
+  guint64 c = crc, v;
+  while (len >= 8) {
+    memcpy(&v, p, 8);
+    c = __builtin_ia32_crc32di(c, v);
+    p += 8;
+    len -= 8;
+  }
+  while (len--)
+    c = __builtin_ia32_crc32qi((guint32)c, *p++);
+  return (guint32)c;
+}
+#endif
+
+/* Pass 0 as crc for the first piece, and the result for the next ones */
+guint32 crc32c(guint32 crc, const void *data, gsize len) {
+  crc = ~crc;
+#if defined(__GNUC__) && defined(__x86_64__)
+  if (crc32c_sse42)
+    return ~crc32c_hw(crc, data, len);
+#endif
+  return ~crc32c_sw(crc, data, len);
+}
+
+static void put_uint32(guchar *p, guint32 v) {
+  p[0] = v & 0xff;
+  p[1] = (v >> 8) & 0xff;
+  p[2] = (v >> 16) & 0xff;
+  p[3] = v >> 24;
+}
+
+static guint32 get_uint32(const guchar *p) {
+  return p[0] | p[1] << 8 | p[2] << 16 | (guint32)p[3] << 24;
+}
+
+void encode_stream_header(guchar *buffer) {
+  memcpy(buffer, STREAM_MAGIC, STREAM_MAGIC_LEN);
+  put_uint32(buffer + STREAM_MAGIC_LEN, STREAM_VERSION);
+}
+
+/* FALSE when it is not a stream of this format, like the ones of the
+ * mydumper versions that separated the files by a "\n-- <filename>\n" line */
+gboolean decode_stream_header(const guchar *buffer, guint32 *version) {
+  if (memcmp(buffer, STREAM_MAGIC, STREAM_MAGIC_LEN))
+    return FALSE;
+  *version = get_uint32(buffer + STREAM_MAGIC_LEN);
+  return TRUE;
+}
+
+void encode_stream_block_header(guchar *buffer,
+                                const struct stream_block_header *h) {
+  buffer[0] = h->type;
+  buffer[1] = buffer[2] = buffer[3] = 0;
+  put_uint32(buffer + 4, h->file_id);
+  put_uint32(buffer + 8, h->length);
+  put_uint32(buffer + 12, h->checksum);
+}
+
+gboolean decode_stream_block_header(const guchar *buffer,
+                                    struct stream_block_header *h) {
+  if (buffer[0] < STREAM_FILE_OPEN || buffer[0] > STREAM_END || buffer[1] ||
+      buffer[2] || buffer[3])
+    return FALSE;
+  h->type = buffer[0];
+  h->file_id = get_uint32(buffer + 4);
+  h->length = get_uint32(buffer + 8);
+  h->checksum = get_uint32(buffer + 12);
+  return TRUE;
+}
@@ -0,0 +1,57 @@
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Authors:        David Ducos, Percona (david dot ducos at percona dot com)
+*/
+#ifndef _src_stream_format_h
+#define _src_stream_format_h
+
+/* The format of --stream. It starts with STREAM_MAGIC and the version, and
+ * then come the blocks, each one with a header of:
+ *
+ *   type (1 byte), reserved (3 bytes), file id, length, crc32c of the data
+ *
+ * and length bytes of data. The integers are 4 bytes, little endian. A file
+ * is declared by a STREAM_FILE_OPEN block that has its name, then its data
+ * comes in STREAM_FILE_DATA blocks, that can be interleaved with the ones of
+ * other files, and STREAM_FILE_CLOSE ends it. STREAM_END ends the stream. */
+#define STREAM_MAGIC "MYDSTRM\n"
+#define STREAM_MAGIC_LEN 8
+#define STREAM_VERSION 1
+#define STREAM_HEADER_SIZE (STREAM_MAGIC_LEN + 4)
+#define STREAM_BLOCK_HEADER_SIZE 16
+
+enum stream_block_type {
+  STREAM_FILE_OPEN = 1,
+  STREAM_FILE_DATA,
+  STREAM_FILE_CLOSE,
+  STREAM_END
+};
+
+struct stream_block_header {
+  enum stream_block_type type;
+  guint32 file_id;
+  guint32 length;
+  guint32 checksum;
+};
+
+void initialize_crc32c();
+guint32 crc32c(guint32 crc, const void *data, gsize len);
+void encode_stream_header(guchar *buffer);
+gboolean decode_stream_header(const guchar *buffer, guint32 *version);
+void encode_stream_block_header(guchar *buffer,
+                                const struct stream_block_header *h);
+gboolean decode_stream_block_header(const guchar *buffer,
+                                    struct stream_block_header *h);
+#endif
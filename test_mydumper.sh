@@ -6,6 +6,7 @@ myloader_log="/tmp/test_myloader.log"
 tmp_myloader_log="/tmp/test_myloader.log.tmp"
 mydumper_stor_dir="/tmp/data"
 myloader_stor_dir=$mydumper_stor_dir
+mydumper_stripe_dir="/tmp/data_stripe"
 stream_stor_dir="/tmp/stream_data"
 mydumper="./mydumper"
 myloader="./myloader"
@@ -24,7 +25,7 @@ test_case_dir (){
   if [ "${mydumper_parameters}" != "" ]
   then
     # Prepare
-    rm -rf ${mydumper_stor_dir}
+    rm -rf ${mydumper_stor_dir} ${mydumper_stripe_dir}
     mkdir -p ${mydumper_stor_dir}
     # Export
     echo "Exporting database: ${mydumper_parameters}"
@@ -103,6 +104,10 @@ full_test(){
 
   # single file compressed -- overriting database
   test_case_dir -c ${general_options}                                 -- -h 127.0.0.1 -o -d ${myloader_stor_dir}
+  # data files striped across two directories -- myloader finds them from the metadata
+  test_case_dir -r 1000 ${general_options} -o ${mydumper_stor_dir},${mydumper_stripe_dir} -- -h 127.0.0.1 -o -d ${myloader_stor_dir} --serialized-table-creation
+  # data files striped across two directories -- myloader is given both
+  test_case_dir -r 1000 ${general_options} -o ${mydumper_stor_dir},${mydumper_stripe_dir} -- -h 127.0.0.1 -o -d ${myloader_stor_dir},${mydumper_stripe_dir} --serialized-table-creation
 
   for test in test_case_dir test_case_stream
   do
@@ -117,12 +122,26 @@ full_test(){
     $test -s 2000000 ${general_options} 			-- -h 127.0.0.1 -o -d ${myloader_stor_dir} --serialized-table-creation
     # compress and rows
     $test -r 1000 -c ${general_options}                         -- -h 127.0.0.1 -o -d ${myloader_stor_dir} --serialized-table-creation
+    # zstd compress and rows
+    $test -r 1000 --compress=zstd ${general_options}            -- -h 127.0.0.1 -o -d ${myloader_stor_dir} --serialized-table-creation
+    # zstd compress with a dictionary per table and rows
+    $test -r 1000 --compress=zstd --compress-dictionary ${general_options} -- -h 127.0.0.1 -o -d ${myloader_stor_dir} --serialized-table-creation
+    # lz4 compress and rows
+    $test -r 1000 --compress=lz4 ${general_options}             -- -h 127.0.0.1 -o -d ${myloader_stor_dir} --serialized-table-creation
     # --load-data
     $test --load-data ${general_options}                        -- -h 127.0.0.1 -o -d ${myloader_stor_dir} --serialized-table-creation
     # --csv
     $test --csv ${general_options}                              -- -h 127.0.0.1 -o -d ${myloader_stor_dir} --serialized-table-creation
+    # --hex-blob
+    $test --hex-blob ${general_options}                         -- -h 127.0.0.1 -o -d ${myloader_stor_dir} --serialized-table-creation
+    # --hex-blob and --load-data
+    $test --hex-blob --load-data ${general_options}             -- -h 127.0.0.1 -o -d ${myloader_stor_dir} --serialized-table-creation
     myloader_stor_dir=$stream_stor_dir
   done
+  # --stream-diskless -- data files streamed from memory
+  test_case_stream --stream-diskless ${general_options}            -- -h 127.0.0.1 -o -d ${myloader_stor_dir} --serialized-table-creation
+  # --stream-diskless, compress and rows
+  test_case_stream -r 1000 -c --stream-diskless ${general_options} -- -h 127.0.0.1 -o -d ${myloader_stor_dir} --serialized-table-creation
   myloader_stor_dir=$mydumper_stor_dir
   for test in test_case_dir test_case_stream
   do